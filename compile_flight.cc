@@ -0,0 +1,23 @@
+#include <flight.hpp>
+
+using namespace asap;
+
+// compile flight files into images, Flight loads either
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " flight.asc flight.img" << std::endl;
+    return 1;
+  }
+  try {
+    Flight::compile(argv[1], argv[2]);
+  }
+  catch (Flight::ParseError& e) {
+    std::cerr << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  catch (std::exception&) {
+    std::cerr << "can not compile " << argv[1] << " to " << argv[2] << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,233 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <flight.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace asap {
+  namespace detail {
+    ////////////////////////////////////////////////////////////
+    //
+    // Multi-producer single-consumer queue of nodes with a next
+    // pointer, which the caller allocates. push is lock-free, one
+    // compare-and-swap on the head; the consumer takes all nodes at
+    // once with one exchange, and gets them oldest first. Nodes
+    // pushed by one thread come out in the order pushed. As take
+    // empties the queue in one exchange, several threads may take
+    // too, e.g. to share a pool of nodes.
+    //
+    // Example:
+    //   struct Node { Node* next; int value; };
+    //   MpscQueue<Node> q;
+    //   q.push(new Node{0, 42});  // on any thread
+    //   for (Node* n = q.take(); n; ) { ...; Node* next = n->next; delete n; n = next; }
+
+    template <typename Node>
+    class MpscQueue {
+    public:
+      MpscQueue() : head_(nullptr) { }
+      MpscQueue(const MpscQueue&) = delete;
+      MpscQueue& operator=(const MpscQueue&) = delete;
+      void push(Node* node) {
+	Node* head = head_.load(std::memory_order_relaxed);
+	do
+	  node->next = head;
+	while (!head_.compare_exchange_weak(head, node));
+      }
+      // everything pushed so far, oldest first, or 0
+      Node* take() {
+	Node* node = head_.exchange(nullptr);
+	Node* result = nullptr;
+	while (node) {
+	  Node* next = node->next;
+	  node->next = result;
+	  result = node;
+	  node = next;
+	}
+	return result;
+      }
+      bool empty() const { return !head_.load(); }
+    private:
+      std::atomic<Node*> head_;
+    };
+  }
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Check-in engine for many flights, e.g. a day's schedule. Flights
+  // are sharded across worker threads, each flight is owned by one
+  // worker. A flight with pending requests sits in its owner's queue
+  // as a whole; idle workers steal such flights from the other
+  // queues. A flight is run by at most one thread at a time, so
+  // Flight itself needs no locking, the only locks are around the
+  // worker queues.
+  //
+  // Flights have to be added before requests are submitted from
+  // other threads. Requests for the same flight are run in the order
+  // they were submitted. They are queued per flight on a lock-free
+  // detail::MpscQueue, and submitting never runs them: the thread
+  // that finds the flight idle puts it in its owner's queue. A worker
+  // runs a flight in turns of at most max_batch requests, and puts
+  // it back at the end of its queue after each turn while requests
+  // are left, so busy flights take turns.
+  //
+  // checkin_async hands back the ids of the seats too, by future or
+  // callback. The group check-ins a turn finds queued next to each
+  // other are seated as one Flight::checkin_batch, in the order
+  // submitted. Request nodes are recycled by the submitting
+  // threads, so a check-in allocates nothing once they are warm,
+  // but for the group itself and the reply's seats.
+  //
+  // Example:
+  //   CheckinEngine engine(4);
+  //   auto id = engine.add_flight("flight.asc");
+  //   PassengerGroup g(TravelCategory::kEconomy);
+  //   g.push("Hugo", SeatType::kWindow, false);
+  //   std::future<Flight::AssignResult> r = engine.checkin(id, g);
+  //   engine.submit(id, [](Flight& f){ f.show(); });
+  //   engine.checkin_async(id, g, [&](CheckinEngine::Reply r) {
+  //       std::cout << (*r.group.begin())->get_name() << ": "
+  //                 << engine.seat_label(id, r.seats[0]) << std::endl; });
+  //   engine.wait();
+
+  class CheckinEngine {
+  public:
+    typedef size_t FlightId;
+    explicit CheckinEngine(size_t n_workers = std::thread::hardware_concurrency());
+    ~CheckinEngine();
+    CheckinEngine(const CheckinEngine&) = delete;
+    CheckinEngine& operator=(const CheckinEngine&) = delete;
+    FlightId add_flight(const std::string& file);
+    FlightId add_flight(std::unique_ptr<Flight> flight);
+    size_t n_flights() const { return slots_.size(); }
+    size_t n_workers() const { return workers_.size(); }
+    // Run f(flight) on the flight's worker, the future holds its result
+    template <typename F>
+    auto submit(FlightId id, F f) -> std::future<decltype(f(std::declval<Flight&>()))>;
+    // The Flight::checkin overloads, run on the flight's worker
+    std::future<Flight::AssignResult> checkin(FlightId, PassengerGroup g);
+    std::future<Flight::AssignResult> checkin(FlightId, TravelCategory, std::string name,
+					      SeatType, bool is_minor = false);
+    std::future<Flight::AssignResult> checkin(FlightId, TravelCategory, std::string name,
+					      bool is_minor, std::string seat_no);
+    std::future<std::vector<Flight::AssignResult> >
+    checkin_batch(FlightId, std::vector<PassengerGroup> groups);
+    // What checkin_async did: the result, the group, sorted as it
+    // was seated, and the id of the seat of each of its passengers,
+    // -1 for those not seated
+    struct Reply {
+      Flight::AssignResult result;
+      PassengerGroup group;
+      std::vector<int> seats;
+    };
+    typedef std::function<void(Reply)> ReplyHandler;
+    // Check in a group, batched with the group check-ins queued
+    // with it. The handler runs on the worker running the flight,
+    // and must not throw.
+    std::future<Reply> checkin_async(FlightId, PassengerGroup g);
+    void checkin_async(FlightId, PassengerGroup g, ReplyHandler done);
+    // Most requests of a flight run per turn, and so most groups
+    // seated by one Flight::checkin_batch, 1 to seat them one by
+    // one; to be set before requests are submitted
+    void set_max_batch(size_t n) { max_batch_ = n ? n : 1; }
+    size_t get_max_batch() const { return max_batch_; }
+    // Label of a seat of a flight, e.g. "12A", from the layout, so
+    // any thread may call it at any time
+    std::string seat_label(FlightId id, int seat) const {
+      return slots_.at(id).flight->seat_label(seat);
+    }
+    // Block until all requests submitted so far are done
+    void wait();
+  private:
+    typedef std::function<void(Flight&)> Task;
+    struct Request {
+      Request* next;
+      // either a task, or a group to check in and its handler
+      Task task;
+      std::optional<PassengerGroup> group;
+      ReplyHandler done;
+    };
+    struct Slot {
+      std::unique_ptr<Flight> flight;
+      // worker the flight is sharded to
+      size_t owner;
+      detail::MpscQueue<Request> inbox;
+      // requests taken from the inbox but not run yet, oldest first,
+      // only touched by the worker running the flight
+      Request* backlog;
+      // buffers for seating a run of group check-ins, same owner
+      std::vector<Request*> batch;
+      std::vector<PassengerGroup> groups;
+      // in some worker's queue or running
+      std::atomic<bool> scheduled;
+    };
+    struct Worker {
+      std::mutex mutex;
+      std::deque<Slot*> queue;
+      std::thread thread;
+    };
+    void post(FlightId id, Task task);
+    void post(FlightId id, Request* request);
+    // a request node, recycled if the thread has one
+    Request* allocate();
+    // clear a node once it is done and hand it back
+    void recycle(Request* request);
+    void enqueue(size_t worker, Slot* slot);
+    // seat the groups of a run of checkin_async requests, and reply
+    void seat(Flight& flight, std::vector<Request*>& batch,
+	      std::vector<PassengerGroup>& groups);
+    // next flight to run for a worker, own queue first, then steal
+    Slot* next(size_t worker);
+    void run(size_t worker);
+    // run up to max_batch_ requests of a flight; true if there are
+    // more and the caller is to queue the flight again
+    bool turn(Slot* s);
+    std::deque<Slot> slots_;
+    std::deque<Worker> workers_;
+    // nodes done with, taken back by submitting threads all at once
+    detail::MpscQueue<Request> spare_;
+    // flights sitting in queues, used to put idle workers to sleep
+    std::atomic<size_t> queued_;
+    // workers waiting for work, only those need waking
+    std::atomic<size_t> idle_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    // requests not yet done
+    std::atomic<size_t> pending_;
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;
+    std::atomic<bool> stop_;
+    size_t max_batch_;
+  };
+
+  template <typename F>
+  auto CheckinEngine::submit(FlightId id, F f)
+    -> std::future<decltype(f(std::declval<Flight&>()))> {
+    typedef decltype(f(std::declval<Flight&>())) R;
+    // std::function wants copyable tasks, hence the shared promise
+    auto promise = std::make_shared<std::promise<R> >();
+    std::future<R> result = promise->get_future();
+    post(id, [promise, f](Flight& flight) mutable {
+	try {
+	  if constexpr (std::is_void<R>::value) {
+	    f(flight);
+	    promise->set_value();
+	  }
+	  else
+	    promise->set_value(f(flight));
+	}
+	catch (...) {
+	  promise->set_exception(std::current_exception());
+	}
+      });
+    return result;
+  }
+}
+
+#endif // _ENGINE_H_
@@ -4,9 +4,26 @@
 #include <fstream>
 #include <exception>
 #include <iostream>
-#include <regex>
+#include <string_view>
 #include <map>
 #include <list>
+#include <deque>
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <stdexcept>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace asap {
 
@@ -37,6 +54,91 @@ namespace asap {
 
   enum class TravelCategory { kFirst, kBusiness, kEconomy };
 
+  ////////////////////////////////////////////////////////////
+  //
+  // How passengers of a group are matched to the seats of a
+  // window. kGreedy seats them one after the other, most restrictive
+  // first (detail::assign). kOptimal solves the assignment exactly,
+  // as a transportation problem between passenger and seat classes.
+
+  enum class AssignMode { kGreedy, kOptimal };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Where a group is looked for. kScan slides a window over all
+  // empty seats of the cabin, across occupied seats, which are
+  // penalized as gaps. kRuns only looks at runs of consecutive empty
+  // seats that hold the whole group, from a detail::FreeRuns index,
+  // and falls back to kScan if there is no such run.
+
+  enum class PlacementMode { kScan, kRuns };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Output formats of Flight::render: the text of Flight::show, one
+  // line per row; compact JSON, cabins holding rows holding seats;
+  // CSV, one line per seat after a header line.
+
+  enum class RenderFormat { kText, kJson, kCsv };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Kinds of neighbouring seats: next to each other in a row, in the
+  // same comma separated group of the seats line; next to each other
+  // across an aisle; and one behind the other, in the same column.
+
+  enum class Neighbor { kSameRow, kAcrossAisle, kFrontBack };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Which occupied seats a window pays neighbor_seat_occupied for.
+  // kIds tests the ids just before and after the window, which cross
+  // aisles and, seat ids running back and forth, row ends. kSeats
+  // charges every occupied neighbour of a seat in the window by the
+  // weight of its kind, see detail::PenaltyWeights::neighbor; by
+  // default only kSameRow neighbours have one.
+
+  enum class NeighborMode { kIds, kSeats };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Where the passengers of a cabin, or of the aircraft, sit on
+  // average, kept as sums over the occupied seats so that adding or
+  // removing a passenger is O(1) and exact. Rows are absolute row
+  // numbers; lateral positions count half seats from the middle of
+  // the row, negative to the left.
+  //
+  // Example:
+  //   LoadBalance b = f.balance(TravelCategory::kEconomy);
+  //   std::cout << b.passengers << " around row " << b.row()
+  //             << ", " << b.lateral() << " seats right" << std::endl;
+
+  struct LoadBalance {
+    LoadBalance() : passengers(0), row_sum(0), lateral_sum(0) { }
+    void add(int row, int lateral) {
+      ++passengers;
+      row_sum += row;
+      lateral_sum += lateral;
+    }
+    void remove(int row, int lateral) {
+      --passengers;
+      row_sum -= row;
+      lateral_sum -= lateral;
+    }
+    LoadBalance& operator+=(const LoadBalance& other) {
+      passengers += other.passengers;
+      row_sum += other.row_sum;
+      lateral_sum += other.lateral_sum;
+      return *this;
+    }
+    // mean row, and mean lateral position in seats; 0 if empty
+    double row() const { return passengers ? double(row_sum) / passengers : 0; }
+    double lateral() const { return passengers ? lateral_sum / 2.0 / passengers : 0; }
+    int passengers;
+    int64_t row_sum;
+    int64_t lateral_sum; // half seats
+  };
+
   namespace detail { // helper classes/functions
     
     ////////////////////////////////////////////////////////////
@@ -55,7 +157,8 @@ namespace asap {
 
     inline void get_lower(std::ifstream &in_f, std::string& s){
       in_f >> s;
-      std::transform(s.begin(), s.end(), s.begin(), tolower);
+      std::transform(s.begin(), s.end(), s.begin(),
+		     [](unsigned char c) { return std::tolower(c); });
     }
 
     ////////////////////////////////////////////////////////////
@@ -122,6 +225,8 @@ namespace asap {
       void set_type(const SeatType& t){
 	type_ = t;
       }
+      const std::string& label() const { return label_; }
+      const SeatType& type() const { return type_; }
     private:
       std::string label_;
       SeatType type_;
@@ -129,17 +234,63 @@ namespace asap {
 
     ////////////////////////////////////////////////////////////
     //
-    // Penalty costs. Adjust to modify the program's behavior.
+    // Penalty costs. A penalty policy is any type with the eight
+    // weights below as members. DefaultPenalties has the original
+    // weights as compile-time constants, which scoring code
+    // specialized on it folds in. PenaltyWeights holds the weights at
+    // runtime, a flight file can set them with lines like
+    //   penalty neighbor_seat_occupied 30
+    // balance charges a window for how far the cabin's center of mass
+    // would be from its center row and from the middle of the rows,
+    // see LoadBalance; it is off by default.
+    // With NeighborMode::kSeats, a seat costs neighbor_seat_occupied
+    // per occupied Neighbor::kSameRow neighbour, neighbor_across_aisle
+    // per occupied kAcrossAisle one and neighbor_front_back per
+    // occupied kFrontBack one. The last two are 0 by default, so by
+    // default only neighbours in the same row count.
     //
     // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
     // \date Sun Oct  6 18:01:06 2013
 
-    const double wrong_seat_penalty = 1;
-    const double wrong_sec_penalty = 100;
-    const double neighbor_seat_occupied_penalty = 20;
-    const double weight_penalty = 1;
-    const double non_contiguous_penalty = 1;
+    struct DefaultPenalties {
+      static constexpr double wrong_seat = 1;
+      static constexpr double wrong_sec = 100;
+      static constexpr double neighbor_seat_occupied = 20;
+      static constexpr double weight = 1;
+      static constexpr double non_contiguous = 1;
+      static constexpr double balance = 0;
+      static constexpr double neighbor_across_aisle = 0;
+      static constexpr double neighbor_front_back = 0;
+    };
 
+    struct PenaltyWeights {
+      PenaltyWeights()
+	: wrong_seat(DefaultPenalties::wrong_seat),
+	  wrong_sec(DefaultPenalties::wrong_sec),
+	  neighbor_seat_occupied(DefaultPenalties::neighbor_seat_occupied),
+	  weight(DefaultPenalties::weight),
+	  non_contiguous(DefaultPenalties::non_contiguous),
+	  balance(DefaultPenalties::balance),
+	  neighbor_across_aisle(DefaultPenalties::neighbor_across_aisle),
+	  neighbor_front_back(DefaultPenalties::neighbor_front_back) { }
+      // set a weight by its member name, false if there is none
+      bool set(const std::string& name, double value);
+      // same weights as DefaultPenalties
+      bool is_default() const;
+      // weight of an occupied neighbour of a kind, for kSeats
+      double neighbor(Neighbor kind) const {
+	return kind == Neighbor::kSameRow ? neighbor_seat_occupied
+	  : kind == Neighbor::kAcrossAisle ? neighbor_across_aisle : neighbor_front_back;
+      }
+      double wrong_seat;
+      double wrong_sec;
+      double neighbor_seat_occupied;
+      double weight;
+      double non_contiguous;
+      double balance;
+      double neighbor_across_aisle;
+      double neighbor_front_back;
+    };
 
     ////////////////////////////////////////////////////////////
     //
@@ -148,8 +299,44 @@ namespace asap {
     // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
     // \date Mon Oct  7 21:40:50 2013
 
+    template <typename Policy = DefaultPenalties>
     double penalty (const std::shared_ptr<Seat>&,
-		    const std::shared_ptr<Passenger> &);
+		    const std::shared_ptr<Passenger> &,
+		    const Policy& policy = Policy());
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Penalty function in terms of the properties of a seat (type,
+    // emergency exit) and a passenger (preference, minor). This is
+    // what the overload above boils down to.
+
+    template <typename Policy = DefaultPenalties>
+    inline double penalty (const SeatType& seat, bool is_exit,
+			   const SeatType& pref, bool is_minor,
+			   const Policy& policy = Policy()) {
+      double result = 0;
+      if (pref != seat && pref != SeatType::kOther)
+	result += policy.wrong_seat;
+      if (is_minor && is_exit)
+	result += policy.wrong_sec;
+      return result;
+    }
+
+    ////////////////////////////////////////////////////////////
+    //
+    // As far as the penalty function is concerned, seats fall into
+    // six classes (type, emergency exit) and so do passengers
+    // (minor, preference). Passenger classes are numbered in the
+    // order established by sort_most_restrictive_first.
+
+    const int n_seat_classes = 6;
+    const int n_passenger_classes = 6;
+    inline int seat_class(const SeatType& t, bool is_exit) {
+      return 2*static_cast<int>(t) + is_exit;
+    }
+    inline int passenger_class(const SeatType& t, bool is_minor) {
+      return 3*!is_minor + static_cast<int>(t);
+    }
 
     ////////////////////////////////////////////////////////////
     //
@@ -172,9 +359,10 @@ namespace asap {
     // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
     // \date Mon Oct  7 21:42:36 2013
 
-    template <typename Iter>
+    template <typename Iter, typename Policy = DefaultPenalties>
     std::pair<Iter, double> find_best_match (Iter first, Iter last,
-					     const std::shared_ptr<Passenger>& p);
+					     const std::shared_ptr<Passenger>& p,
+					     const Policy& policy = Policy());
   
     ////////////////////////////////////////////////////////////
     //
@@ -184,8 +372,9 @@ namespace asap {
     // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
     // \date Mon Oct  7 21:43:51 2013
 
-    template <typename Iter1, typename Iter2>
-    double match(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts);
+    template <typename Iter1, typename Iter2, typename Policy = DefaultPenalties>
+    double match(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		 const Policy& policy = Policy());
 
     ////////////////////////////////////////////////////////////
     //
@@ -195,9 +384,837 @@ namespace asap {
     // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
     // \date Mon Oct  7 21:44:31 2013
 
+    template <typename Iter1, typename Iter2, typename Policy = DefaultPenalties>
+    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		const Policy& policy = Policy());
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Solution of the transportation problem between passenger
+    // classes and seat classes: flow[pc][sc] passengers of class pc
+    // go to seats of class sc, at a total penalty of cost.
+
+    struct TransportPlan {
+      int flow[n_passenger_classes][n_seat_classes];
+      double cost;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Seat as many passengers as possible at the lowest total
+    // penalty, given the number of passengers in each class
+    // (supply) and the number of seats in each class (demand). This
+    // is a min-cost flow on a graph with 14 nodes, solved by
+    // successive shortest paths, so it takes the same time for a
+    // group of two as for a group of two hundred.
+
+    void solve_transport(const std::array<int, n_passenger_classes>& supply,
+			 const std::array<int, n_seat_classes>& demand,
+			 const double (&cost)[n_passenger_classes][n_seat_classes],
+			 TransportPlan& plan);
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Assign passengers to seats following a transport plan. Each
+    // passenger takes the first free seat of a class the plan routes
+    // its class to.
+
     template <typename Iter1, typename Iter2>
-    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts);
+    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		TransportPlan plan);
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Argmin kernel over seat class bytes. rank maps each seat class
+    // to the rank of its penalty for one passenger class, equal
+    // penalties having equal rank. first_min returns the index of the
+    // first byte of lowest rank, i.e. what std::min_element on the
+    // penalties gives, or n for n == 0. Ranks and classes are below
+    // 16. The vector versions look up ranks 16 (SSSE3) or 32 (AVX2)
+    // bytes at a time, the best one the cpu supports is picked at
+    // runtime.
+    //
+    // Example:
+    //   unsigned char rank[16] = {1, 0, 2, 2}; // classes 0..3
+    //   size_t j = first_min(classes, n, rank);
+
+    enum class Isa { kScalar, kSsse3, kAvx2 };
+    // best instruction set of this cpu the kernels can use
+    Isa detected_isa();
+    // with a given instruction set, capped at detected_isa()
+    size_t first_min(const unsigned char* data, size_t n,
+		     const unsigned char* rank, Isa isa);
+    size_t first_min(const unsigned char* data, size_t n,
+		     const unsigned char* rank);
+
+    // fewer windows than this are not worth handing to other threads:
+    // a window takes about 22 ns to score, a SlicePool::run of 2 to 4
+    // slices 1 to 4 us, so splitting pays from 150 to 250 windows on;
+    // the rest is margin for waking threads on other cores
+    const size_t default_parallel_windows = 1024;
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Threads that WindowScorer::best_window hands slices of its
+    // windows to. They are started as calls ask for more of them and
+    // kept for the life of the process, waiting for work. run(n, f)
+    // calls f(0) on the calling thread and f(1) up to f(n - 1) on the
+    // pool, takes back the slices no pool thread has started yet and
+    // returns once all are done. Calls from several threads at once
+    // share the pool. Nothing is allocated per call.
+    //
+    // Example:
+    //   std::array<int, 4> sums{};
+    //   auto slice = [&](size_t t) { sums[t] = sum_of_part(t); };
+    //   SlicePool::instance().run(4, slice);
+
+    class SlicePool {
+    public:
+      static SlicePool& instance();
+      template <typename F>
+      void run(size_t n, F& f) {
+	run(n, [](void* f, size_t t) { (*static_cast<F*>(f))(t); }, &f);
+      }
+    private:
+      SlicePool() { }
+      struct Job {
+	void (*call)(void*, size_t);
+	void* f;
+	size_t n;
+	// next slice to start, slices done
+	size_t next;
+	size_t done;
+      };
+      void run(size_t n, void (*call)(void*, size_t), void* f);
+      // body of the pool threads
+      void work();
+      std::mutex lock_;
+      std::condition_variable work_cv_;
+      std::condition_variable done_cv_;
+      // jobs with slices not started yet
+      std::deque<Job*> jobs_;
+      std::vector<std::thread> threads_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Scoring engine for the sliding window in Flight::checkin. The
+    // empty seats are pushed in ascending id order, the engine keeps
+    // prefix counts of seat classes and prefix sums of the intrinsic
+    // cost, so that everything but the passenger penalty of a window
+    // is available in constant time. The passenger penalty is
+    // computed from the class histogram of the group, replaying
+    // match() class by class. Only if match() would break a tie
+    // between seat classes that matters later on by seat order, the
+    // window is either discarded by a lower bound or replayed seat by
+    // seat. Either way, the result is what match() would give. In
+    // AssignMode::kOptimal the passenger penalty is the one of the
+    // optimal assignment instead.
+    //
+    // Example:
+    //   WindowScorer w;
+    //   for (auto s : empty_seats)
+    //     w.push_back(seat_class(s->get_seat_type(),
+    //                            s->is_emergency_exit_seat()),
+    //                 s->get_id(), s->get_intrinsic_cost());
+    //   w.set_group(g.begin(), g.end()); // g sorted
+    //   size_t offset = w.best_window();
+
+    class WindowScorer {
+    public:
+      WindowScorer();
+      void clear();
+      void push_back(int seat_class, int id, double cost);
+      // the same, for scoring balance too: row is the seat's row
+      // relative to the cabin's center row, lateral its LoadBalance
+      // position. Only after set_balance.
+      void push_back(int seat_class, int id, double cost, int row, int lateral);
+      // turn on the balance term until the next clear, with the
+      // moments of the seats already taken, as sums of the row and
+      // lateral values push_back takes
+      void set_balance(int64_t row_moment, int64_t lateral_moment);
+      template <typename Iter>
+      void set_group(Iter first, Iter last);
+      size_t size() const { return ids_.size(); }
+      // id of the i-th seat pushed
+      int id(size_t i) const { return ids_[i]; }
+      // no. of seats in a window
+      size_t window() const { return std::min(group_size_, size()); }
+      // what match() returns for the window starting at offset, plus
+      // the balance term
+      double score(size_t offset) const;
+      // the window Flight::checkin picks
+      size_t best_window() const;
+      // the best window if the seats pushed are one run of
+      // consecutive ids, and left (right) tells whether the seat
+      // before (after) the run is taken. False if none scores below
+      // best_score, which is updated otherwise.
+      bool best_in_run(bool left, bool right, size_t& best, double& best_score) const;
+      // match the group to the window starting at offset: the k-th
+      // passenger (in sorted order) gets seat no. seat_of[k], counted
+      // from the first seat pushed, or -1 if there is no seat left
+      void assign(size_t offset, std::vector<int>& seat_of) const;
+      // drop n seats starting at offset, e.g. after assigning them;
+      // the balance term counts them as taken from then on
+      void erase(size_t offset, size_t n);
+      // the same, but only marks the seats: best_window() skips
+      // windows with a marked seat until compact() drops them all in
+      // one pass, and returns size() if no window is clear of them
+      void take(size_t offset, size_t n);
+      void compact();
+      void set_mode(AssignMode mode) { mode_ = mode; }
+      // whether best_window charges the ids next to a window as
+      // occupied neighbours; off if the costs pushed include them
+      void set_id_neighbors(bool on) { id_neighbors_ = on; }
+      // weights to score with, DefaultPenalties unless set
+      void set_policy(const PenaltyWeights& policy);
+      // let best_window() score on up to n_threads threads, once
+      // there are at least min_windows windows; 1 means serial
+      void set_parallel(unsigned n_threads,
+			size_t min_windows = default_parallel_windows) {
+	n_threads_ = n_threads ? n_threads : 1;
+	min_windows_ = min_windows;
+      }
+      // optimal class assignment for the window starting at offset
+      void plan(size_t offset, TransportPlan& result) const;
+      // windows looked at, and those whose passenger penalty was
+      // computed, since construction
+      uint64_t n_windows() const { return n_windows_; }
+      uint64_t n_penalties() const { return n_penalties_; }
+    private:
+      // best_window() for a given policy, which is either weights_
+      // or DefaultPenalties if weights_ has the default values
+      template <typename Policy>
+      size_t best_window(const Policy& policy) const;
+      template <typename Policy>
+      bool best_in_run(bool left, bool right, size_t& best, double& best_score,
+		       const Policy& policy) const;
+      // best_window() while seats are marked taken: scores the
+      // windows between marked seats as if those were dropped
+      template <typename Policy>
+      size_t best_live(const Policy& policy) const;
+      // best window with offset in [first, end), if it scores below
+      // best_score; ties go to the lower offset
+      template <typename Policy>
+      void best_in(size_t first, size_t end, size_t& best, double& best_score,
+		   std::vector<unsigned char>& scratch, uint64_t& n_penalties,
+		   const Policy& policy) const;
+      // passenger penalty of a window in the current mode
+      double passenger_penalty(size_t offset,
+			       std::vector<unsigned char>& scratch) const;
+      // passenger penalty of a window, replaying match() on classes,
+      // returns false if the seat order would matter
+      bool class_penalty(size_t offset, double& result) const;
+      // passenger penalty of a window, replaying match() seat by seat
+      double seat_penalty(size_t offset, std::vector<unsigned char>& scratch) const;
+      // lower bound for the passenger penalty of a window
+      double penalty_bound(size_t offset) const;
+      // everything but the passenger penalty
+      template <typename Policy>
+      double fixed_cost(size_t offset, const Policy& policy) const;
+      // the balance term of a window, O(1) from the prefix sums
+      template <typename Policy>
+      double balance_cost(size_t offset, const Policy& policy) const {
+	if (!policy.balance || !balance_)
+	  return 0;
+	const size_t end = offset + window();
+	return policy.balance
+	  * (std::abs(moment_[0] + row_[end] - row_[offset])
+	     + std::abs(moment_[1] + lateral_[end] - lateral_[offset]) / 2.0);
+      }
+      int count(size_t offset, int sc) const {
+	return count_[offset + window()][sc] - count_[offset][sc];
+      }
+      typedef std::array<int, n_seat_classes> class_count;
+      std::vector<int> ids_;
+      std::vector<unsigned char> classes_;
+      std::vector<double> cost_; // prefix sums
+      std::vector<class_count> count_; // prefix counts
+      // seats marked by take(), and their no.
+      std::vector<unsigned char> taken_;
+      size_t n_taken_;
+      // with balance_, prefix sums of the rows and lateral positions
+      // pushed, and the moments of the seats taken
+      bool balance_;
+      std::vector<int64_t> row_, lateral_;
+      int64_t moment_[2];
+      std::array<int, n_passenger_classes> group_;
+      size_t group_size_;
+      AssignMode mode_;
+      unsigned n_threads_;
+      size_t min_windows_;
+      PenaltyWeights weights_;
+      double pen_[n_passenger_classes][n_seat_classes];
+      // pen_ as ranks, for first_min
+      unsigned char rank_[n_passenger_classes][16];
+      mutable std::vector<unsigned char> scratch_;
+      mutable std::vector<int> order_;
+      // what each parallel slice of best_window found, a cache line
+      // each
+      struct alignas(64) Slice {
+	size_t best;
+	double score;
+	uint64_t n_penalties;
+      };
+      mutable std::vector<Slice> slices_;
+      mutable uint64_t n_windows_, n_penalties_;
+      bool id_neighbors_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Bitmap, one bit per seat id, with two more levels holding one
+    // bit per word that is all set, and one per word that is not
+    // empty. Setting and clearing bits is O(1), and each_clear skips
+    // full words 64 at a time, so walking the clear bits costs their
+    // number plus n / 4096. next_set and prev_set_end skip empty
+    // words the same way.
+
+    class Bitmap {
+    public:
+      void resize(size_t n) {
+	words_.assign((n + 63) / 64, 0);
+	full_.assign((words_.size() + 63) / 64, 0);
+	any_.assign(full_.size(), 0);
+      }
+      bool test(size_t i) const { return words_[i / 64] >> (i % 64) & 1; }
+      void set(size_t i) {
+	any_[i / 4096] |= uint64_t(1) << (i / 64 % 64);
+	if (!~(words_[i / 64] |= uint64_t(1) << (i % 64)))
+	  full_[i / 4096] |= uint64_t(1) << (i / 64 % 64);
+      }
+      void reset(size_t i) {
+	if (!(words_[i / 64] &= ~(uint64_t(1) << (i % 64))))
+	  any_[i / 4096] &= ~(uint64_t(1) << (i / 64 % 64));
+	full_[i / 4096] &= ~(uint64_t(1) << (i / 64 % 64));
+      }
+      // first set bit in [i, last), or last
+      size_t next_set(size_t i, size_t last) const {
+	if (i >= last)
+	  return last;
+	size_t w = i / 64;
+	uint64_t bits = words_[w] & ~uint64_t(0) << (i % 64);
+	while (!bits) {
+	  if ((w + 1) * 64 >= last)
+	    return last;
+	  size_t f = (w + 1) / 64;
+	  uint64_t words = any_[f] & ~uint64_t(0) << ((w + 1) % 64);
+	  while (!words) {
+	    if (++f * 4096 >= last)
+	      return last;
+	    words = any_[f];
+	  }
+	  w = f * 64 + __builtin_ctzll(words);
+	  bits = words_[w];
+	}
+	return std::min(w * 64 + __builtin_ctzll(bits), last);
+      }
+      // one past the last set bit in [first, i), or first
+      size_t prev_set_end(size_t first, size_t i) const {
+	if (i <= first)
+	  return first;
+	size_t w = (i - 1) / 64;
+	uint64_t bits = words_[w] & ~uint64_t(0) >> (63 - (i - 1) % 64);
+	while (!bits) {
+	  if (w * 64 <= first)
+	    return first;
+	  size_t f = (w - 1) / 64;
+	  uint64_t words = any_[f] & ~uint64_t(0) >> (63 - (w - 1) % 64);
+	  while (!words) {
+	    if (f * 4096 <= first)
+	      return first;
+	    words = any_[--f];
+	  }
+	  w = f * 64 + 63 - __builtin_clzll(words);
+	  bits = words_[w];
+	}
+	return std::max(w * 64 + 64 - __builtin_clzll(bits), first);
+      }
+      // call op(i) for every clear bit i in [first, last), ascending
+      template <typename Op>
+      void each_clear(size_t first, size_t last, Op op) const {
+	if (first >= last)
+	  return;
+	const size_t first_word = first / 64, last_word = (last - 1) / 64;
+	for (size_t f = first_word / 64; f <= last_word / 64; ++f) {
+	  uint64_t words = ~full_[f];
+	  if (f == first_word / 64)
+	    words &= ~uint64_t(0) << (first_word % 64);
+	  if (f == last_word / 64 && last_word % 64 != 63)
+	    words &= ~(~uint64_t(0) << (last_word % 64 + 1));
+	  for (; words; words &= words - 1) {
+	    const size_t w = f * 64 + __builtin_ctzll(words);
+	    uint64_t bits = ~words_[w];
+	    if (w == first_word)
+	      bits &= ~uint64_t(0) << (first % 64);
+	    if (w == last_word && last % 64)
+	      bits &= ~(~uint64_t(0) << (last % 64));
+	    for (; bits; bits &= bits - 1)
+	      op(w * 64 + __builtin_ctzll(bits));
+	  }
+	}
+      }
+    private:
+      std::vector<uint64_t> words_;
+      // bit w set if words_[w] is all set
+      std::vector<uint64_t> full_;
+      // bit w set if words_[w] is not zero
+      std::vector<uint64_t> any_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Index of the maximal runs of consecutive clear bits of a
+    // Bitmap, i.e. of the runs of empty seats, per cabin. Runs are
+    // kept in one list per cabin and floor(log2(length)), linked
+    // through arrays indexed by the first id of a run, so keeping the
+    // index up to date allocates nothing: a seat taken splits its
+    // run, a seat freed joins its neighbours. The run around a seat
+    // is found through Bitmap::prev_set_end and next_set. each(k, n)
+    // visits the runs of at least n seats, and skips the lists of
+    // shorter ones.
+    //
+    // Example:
+    //   Bitmap taken;
+    //   taken.resize(10);
+    //   FreeRuns runs;
+    //   runs.clear(10);
+    //   runs.add(0, taken, 0, 10);  // cabin 0 is ids 0 to 9
+    //   taken.set(4);
+    //   runs.update(0, taken, 4, 0, 10);
+    //   runs.each(0, 5, [](int first, int last) { });  // [5, 10)
+
+    class FreeRuns {
+    public:
+      static const int n_cabins = 3;
+      // no runs, for ids up to n
+      void clear(size_t n);
+      // index the clear bits of taken in [first, last), as cabin k
+      void add(int k, const Bitmap& taken, int first, int last);
+      // bit id of taken, in cabin k = [first, last), was set or
+      // cleared since the last call
+      void update(int k, const Bitmap& taken, int id, int first, int last);
+      // call op(first, last) for every run [first, last) in cabin k
+      // of at least n ids, in no particular order
+      template <typename Op>
+      void each(int k, int n, Op op) const {
+	for (int b = n > 1 ? 31 - __builtin_clz(n) : 0; b < 32; ++b)
+	  for (int r = head_[k][b]; r >= 0; r = next_[r])
+	    if (end_[r] - r >= n)
+	      op(r, end_[r]);
+      }
+    private:
+      void link(int k, int first, int last);
+      void unlink(int k, int first);
+      // by first id of a run: one past its last id, and the next and
+      // previous run in its list
+      std::vector<int> end_, next_, prev_;
+      // first run of each list, -1 if empty
+      std::array<std::array<int, 32>, n_cabins> head_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Passenger storage of a Flight, as an alternative to one
+    // shared_ptr<Passenger> per passenger. Passengers are appended to
+    // a flat array and identified by their 32 bit index. Names are
+    // interned into one contiguous pool, through an open addressing
+    // hash of name indices, so a passenger costs eight bytes plus its
+    // name, once per distinct name. Nothing is freed one by one; the
+    // arena goes away as a whole with its flight.
+    //
+    // Example:
+    //   PassengerArena a;
+    //   PassengerArena::Handle h = a.add("Kate", SeatType::kWindow, false);
+    //   a.add("Kate", SeatType::kAisle, true); // same name, stored once
+    //   // a.name(h) == "Kate", a.size() == 2, a.n_names() == 1
+
+    class PassengerArena {
+    public:
+      typedef uint32_t Handle;
+      PassengerArena() : n_names_(0) { }
+      Handle add(std::string_view name, SeatType type, bool minor);
+      std::string_view name(Handle h) const {
+	const uint32_t n = passengers_[h].name;
+	return std::string_view(pool_.data() + names_[n], names_[n + 1] - names_[n]);
+      }
+      SeatType type(Handle h) const { return static_cast<SeatType>(passengers_[h].type); }
+      bool is_minor(Handle h) const { return passengers_[h].minor; }
+      size_t size() const { return passengers_.size(); }
+      size_t n_names() const { return n_names_; }
+      void reserve(size_t n) { passengers_.reserve(n); }
+      // bytes held, for comparison with shared_ptr passengers
+      size_t memory() const {
+	return passengers_.capacity() * sizeof(Record) + pool_.capacity()
+	  + (names_.capacity() + slots_.capacity()) * sizeof(uint32_t);
+      }
+    private:
+      uint32_t intern(std::string_view name);
+      struct Record {
+	uint32_t name;
+	uint8_t type;
+	bool minor;
+      };
+      std::vector<Record> passengers_;
+      std::vector<char> pool_;
+      // name i is pool_[names_[i], names_[i + 1])
+      std::vector<uint32_t> names_;
+      // name index + 1 by hash, 0 is empty
+      std::vector<uint32_t> slots_;
+      uint32_t n_names_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Who sits where, by seat id: the handle of the passenger, and
+    // the group seated with it. Entries come in blocks of 64 seats,
+    // the words of the occupancy Bitmap, and a block is only added
+    // once one of its seats is written, so an empty flight holds one
+    // index per block. Blocks stay until the table goes.
+    //
+    // Example:
+    //   OccupantTable t;
+    //   t.assign(360);      // no entries yet
+    //   t[130].handle = 7;  // adds the block of seats 128 to 191
+    //   // t.n_blocks() == 1, t[131].group == 0
+
+    class OccupantTable {
+    public:
+      struct Entry {
+	unsigned handle;
+	uint32_t group;
+      };
+      // n seats, without entries
+      void assign(size_t n) {
+	block_.assign((n + 63) / 64, kNone);
+	entries_.clear();
+      }
+      // room for every block, so that adding one never allocates
+      void reserve() { entries_.reserve(block_.size() * 64); }
+      Entry& operator[](int id) {
+	uint32_t& b = block_[id / 64];
+	if (b == kNone) {
+	  b = entries_.size() / 64;
+	  entries_.resize(entries_.size() + 64);
+	}
+	return entries_[b * 64 + id % 64];
+      }
+      // only for seats that were written, such as the taken ones
+      const Entry& operator[](int id) const {
+	return entries_[block_[id / 64] * 64 + id % 64];
+      }
+      size_t n_blocks() const { return entries_.size() / 64; }
+    private:
+      static constexpr uint32_t kNone = ~uint32_t(0);
+      // index of the block of each 64 seats into entries_, or kNone
+      std::vector<uint32_t> block_;
+      std::vector<Entry> entries_;
+    };
 
+    ////////////////////////////////////////////////////////////
+    //
+    // Static seat layout of a flight, stored as structure of
+    // arrays. Seats are identified by their id, which is the index
+    // into the arrays. Per seat, only the seat class (type and
+    // emergency exit) and the distance of its row from the desired
+    // center of mass are stored. Everything else (row, label) follows
+    // from the id and the cabin it belongs to. Seat labels ("12A")
+    // are looked up through a hash of (cabin, label) and a table
+    // mapping row numbers to cabins.
+    //
+    // Within a cabin, ids are handed out row by row, alternating
+    // left-to-right and right-to-left to have some basic load
+    // balancing. Hence consecutive ids are (mostly) next to each
+    // other.
+    //
+    // Example:
+    //   SeatMap m;
+    //   SeatMap::Cabin c;
+    //   ... // fill in c
+    //   m.add_cabin(c);
+    //   for (int id = 0; id < m.size(); ++id)
+    //     std::cout << m.label(id) << std::endl;
+
+    class MappedFile;
+    class SeatMap;
+    struct Layout;
+    void load_layout_image(const std::shared_ptr<const MappedFile>& file, SeatMap& seats,
+			   std::string& flight_number, PenaltyWeights& penalties);
+
+    class SeatMap {
+    public:
+      struct Cabin {
+	TravelCategory cat;
+	// absolute row number of the first row, no. of rows
+	int first_row;
+	int rows;
+	// row where the center of mass should be
+	int center;
+	// bit per absolute row no., set for emergency exit rows
+	std::vector<bool> emergency;
+	// seat labels and types in a row, left to right
+	std::vector<std::string> labels;
+	std::vector<SeatType> types;
+	// comma separated group of each seat in a row, counting from
+	// the left; aisles are between groups
+	std::vector<unsigned char> groups;
+	// id of the first seat, set by add_cabin
+	int first_seat;
+	int row_size() const { return labels.size(); }
+	int seats() const { return rows * row_size(); }
+	bool is_exit_row(int row) const {
+	  return row >= 0 && static_cast<size_t>(row) < emergency.size() && emergency[row];
+	}
+      };
+      SeatMap() : class_(0), dist_(0), size_(0), adj_first_(0), adj_(0) { }
+      SeatMap(const SeatMap& other);
+      SeatMap& operator=(const SeatMap& other);
+      SeatMap(SeatMap&&) = default;
+      SeatMap& operator=(SeatMap&&) = default;
+      void add_cabin(Cabin c);
+      int size() const { return size_; }
+      const std::vector<Cabin>& cabins() const { return cabins_; }
+      // cabin of a category, or 0 if there is none
+      const Cabin* cabin(const TravelCategory& cat) const;
+      const Cabin& cabin_of(int id) const;
+      int seat_class(int id) const { return class_[id]; }
+      SeatType type(int id) const { return static_cast<SeatType>(class_[id] / 2); }
+      bool is_exit(int id) const { return class_[id] % 2; }
+      // distance of a seat's row from the center of mass
+      int dist(int id) const { return dist_[id]; }
+      int row(int id) const;
+      // position in a row, counting from the left
+      int column(int id) const;
+      // position in a row, in half seats from the middle of the
+      // row, negative to the left; see LoadBalance
+      int lateral(int id) const {
+	return 2 * column(id) - (cabin_of(id).row_size() - 1);
+      }
+      // id of the seat at (row index, column) in a cabin
+      int at(const Cabin& c, int row_index, int column) const {
+	const int n = c.row_size();
+	return c.first_seat + row_index * n
+	  + (row_index % 2 ? column : n - 1 - column);
+      }
+      std::string label(int id) const {
+	return std::to_string(row(id)) + cabin_of(id).labels[column(id)];
+      }
+      // id of the seat with the given label, e.g. "12A", or -1
+      int find(const std::string& label) const;
+      // call op(neighbour id, Neighbor kind) for every neighbour of a
+      // seat, from a table built with the cabin
+      template <typename Op>
+      void each_neighbor(int id, Op op) const {
+	for (uint32_t i = adj_first_[id]; i < adj_first_[id + 1]; ++i)
+	  op(static_cast<int>(adj_[i] >> 2), static_cast<Neighbor>(adj_[i] & 3));
+      }
+    private:
+      friend void compile_layout(const Layout&, std::string&);
+      friend void load_layout_image(const std::shared_ptr<const MappedFile>&, SeatMap&,
+				    std::string&, PenaltyWeights&);
+      // hash key for a seat label in a cabin, 0 for labels too long
+      static uint64_t key(int cabin, const char* first, const char* last);
+      // fill in the row and label index for a cabin
+      void index(const Cabin& c, int index);
+      // add the neighbours of a cabin's seats to the own tables
+      void link(const Cabin& c);
+      // point class_, dist_ and the neighbour tables at the vectors
+      // below
+      void own();
+      std::vector<Cabin> cabins_;
+      // cabin index by row number, -1 for no such row
+      std::vector<signed char> row_cabin_;
+      // column by key(cabin, label)
+      std::unordered_map<uint64_t, int> columns_;
+      // per seat class and distance; these point either into the
+      // vectors below or into a mapped image, which image_ keeps
+      const unsigned char* class_;
+      const unsigned short* dist_;
+      int size_;
+      std::vector<unsigned char> own_class_;
+      std::vector<unsigned short> own_dist_;
+      std::shared_ptr<const MappedFile> image_;
+      // neighbours of seat id are adj_[adj_first_[id]] up to
+      // adj_[adj_first_[id + 1]], as id << 2 | kind; built with the
+      // cabins or, like class_ and dist_, taken from an image
+      const uint32_t* adj_first_;
+      const uint32_t* adj_;
+      std::vector<uint32_t> own_adj_first_;
+      std::vector<uint32_t> own_adj_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Parser for flight files. The whole file is scanned once, in
+    // place: tokens are string_views into the text, keywords are
+    // told apart by a switch on length and first letter, and case
+    // is ignored. Unknown words are skipped, as they always were.
+    // Malformed input throws a Flight::ParseError carrying line and
+    // column. Cabins come out in TravelCategory order, cabins without
+    // rows are left out.
+    //
+    // Example:
+    //   Layout l;
+    //   parse_layout("Flight X\nECONOMY\nrows 2\nseats A B,C D\n", l);
+    //   // l.cabins[0].labels == {"A", "B", "C", "D"}
+
+    struct Layout {
+      std::string flight_number;
+      std::vector<SeatMap::Cabin> cabins;
+      PenaltyWeights penalties;
+    };
+
+    void parse_layout(std::string_view text, Layout& result);
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Read-only view of a whole file. Where the system has mmap,
+    // files of 160 KiB and more are mapped, smaller ones are read
+    // with a single read, which is cheaper than mapping a few pages.
+
+    class MappedFile {
+    public:
+      // throws Flight::FileNotFoundError
+      explicit MappedFile(const std::string& name);
+      ~MappedFile();
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+      const char* data() const { return data_; }
+      size_t size() const { return size_; }
+    private:
+      const char* data_;
+      size_t size_;
+      bool mapped_;
+      std::string buffer_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Compiled layouts. compile_layout turns a parsed layout into a
+    // binary image: a header (magic, version, byte order, size,
+    // checksum, counts, penalty weights), the cabin table, a column
+    // table with seat types and labels, the per seat class and
+    // distance arrays and a string pool. load_layout_image checks an
+    // image and points a SeatMap at the seat arrays in place; only
+    // the per cabin tables are copied. Bad images throw
+    // Flight::InputFileFormatError.
+    //
+    // Example:
+    //   Layout l;
+    //   parse_layout(text, l);
+    //   std::string image;
+    //   compile_layout(l, image); // write image to a file
+    //   ...
+    //   auto file = std::make_shared<const MappedFile>("flight.img");
+    //   load_layout_image(file, seats, flight_number, penalties);
+
+    const uint32_t layout_image_version = 5;
+    void compile_layout(const Layout& layout, std::string& image);
+    // whether data starts like an image, it is checked on loading
+    bool is_layout_image(const char* data, size_t size);
+    // FNV-1a hash, the checksum of journals and snapshots
+    uint32_t fnv1a(const char* first, const char* last);
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Write-ahead journal of a flight's check-ins, see
+    // Flight::open_journal. Journal itself lives in journal.cc, a
+    // flight only holds it through JournalRef. A journal belongs to
+    // one flight: copies of a flight, and flights assigned to, are
+    // left without one.
+
+    class Journal;
+
+    class JournalRef {
+    public:
+      JournalRef();
+      JournalRef(const JournalRef&);
+      JournalRef(JournalRef&&);
+      JournalRef& operator=(const JournalRef&);
+      JournalRef& operator=(JournalRef&&);
+      ~JournalRef();
+      Journal* get() const { return journal_.get(); }
+      void reset(Journal* journal = 0);
+    private:
+      std::unique_ptr<Journal> journal_;
+    };
+
+    ////////////////////////////////////////////////////////////
+    //
+    // Local search over a seating, for Flight::reoptimize. Each
+    // passenger belongs to a group, the one it was checked in with;
+    // a group pays what the window search charges it: the penalties
+    // of its passengers, the cost of its seats, its gaps, and the
+    // seats of other groups next to it, by ids or by seats as in
+    // NeighborMode. The balance weight is charged per cabin, on its
+    // moments. A step moves one passenger to a random seat of its
+    // cabin, swapping with whoever sits there, or shifts a whole
+    // group; only the groups around the seats that changed are
+    // scored again, and the step is undone if it made the total
+    // worse. Passengers in group 0 chose their seat and never move.
+    //
+    // Example:
+    //   LocalSearch s(seats, penalties, NeighborMode::kIds);
+    //   s.add(id, passenger_class(SeatType::kWindow, false), 1);
+    //   ...
+    //   std::mt19937 rng;
+    //   while (...)
+    //     s.step(rng);
+    //   // s.seat(p) is where the p-th passenger added sits now
+
+    class LocalSearch {
+    public:
+      LocalSearch(const SeatMap& seats, const PenaltyWeights& policy, NeighborMode mode);
+      // a passenger of a class and group in seat id
+      void add(int id, int pc, uint32_t group);
+      size_t size() const { return passengers_.size(); }
+      int seat(size_t p) const { return passengers_[p].seat; }
+      // whether any passenger may move
+      bool can_move() const { return !movable_.empty(); }
+      // sum over all groups and cabins
+      double total() const;
+      // one random move, kept if the total does not go up; true if
+      // it was kept
+      bool step(std::mt19937& rng);
+    private:
+      struct Member {
+	int seat;
+	int pc;
+	int group; // index into groups_
+	bool pinned;
+      };
+      double group_cost(int g) const;
+      double balance_cost(int cabin) const;
+      // add sign times the position of seat id to its cabin's moments
+      void shift_moment(int id, int sign);
+      // move the passengers of moves_ to their new seats, updating
+      // who_ and the moments; moves_ then holds their old seats
+      void apply();
+      // note the groups next to seat id
+      void touch(int id);
+      const SeatMap& seats_;
+      PenaltyWeights policy_;
+      NeighborMode mode_;
+      double pen_[n_passenger_classes][n_seat_classes];
+      std::vector<Member> passengers_;
+      std::vector<std::vector<int> > groups_;
+      // group index by Flight group number, for those above 0
+      std::unordered_map<uint32_t, int> group_index_;
+      std::vector<int> movable_;
+      // passenger in each seat, -1 if empty
+      std::vector<int> who_;
+      // per seat, the cost of the seat and its cabin index; per cabin
+      // the moments about its center, as in LoadBalance
+      std::vector<double> cost_;
+      std::vector<signed char> cabin_;
+      std::vector<std::array<int64_t, 2> > moment_;
+      // the move under way: passengers and their new seats
+      std::vector<std::pair<int, int> > moves_;
+      // groups to score again, and a mark per group
+      std::vector<int> touched_;
+      std::vector<uint32_t> mark_;
+      uint32_t stamp_;
+    };
   }
 
   ////////////////////////////////////////////////////////////
@@ -223,7 +1240,7 @@ namespace asap {
   public:
     Seat(SeatType type, int id, std::string desc = "", double cost = 0,
 	 bool is_emergency_exit_seat = false) :
-      type_(type), id_(id), desc_(desc), cost_(cost),
+      type_(type), id_(id), desc_(std::move(desc)), cost_(cost),
       is_emergency_exit_seat_(is_emergency_exit_seat) { }
     std::string get_info() const {
       return desc_ + "(" + detail::CatMap::instance().desc(type_)
@@ -233,7 +1250,7 @@ namespace asap {
     bool is_emergency_exit_seat() const {
       return is_emergency_exit_seat_;
     }
-    std::shared_ptr<Passenger> get_passenger() const {
+    const std::shared_ptr<Passenger>& get_passenger() const {
       return passenger_;
     }
     int get_id() const { return id_; }
@@ -265,7 +1282,7 @@ namespace asap {
   class Passenger {
   public:
     Passenger(std::string name, SeatType type, bool minor) :
-      name_(name), type_(type), is_minor_(minor) { }
+      name_(std::move(name)), type_(type), is_minor_(minor) { }
     const SeatType& get_seat_type() const { return type_; }
     bool is_minor() const { return is_minor_; }
     const std::string& get_name() const { return name_; }
@@ -291,9 +1308,10 @@ namespace asap {
   public:
     explicit PassengerGroup(TravelCategory cat) : cat_(cat) { }
     explicit PassengerGroup(const std::string& file);
-    void push (const std::string& name, const SeatType& type, bool minor) {
-      passengers_.push_back(std::make_shared<Passenger>(name, type, minor));
+    void push (std::string name, const SeatType& type, bool minor) {
+      passengers_.push_back(std::make_shared<Passenger>(std::move(name), type, minor));
     }
+    void reserve(size_t n) { passengers_.reserve(n); }
     void empty() { passengers_.resize(0); }
     typedef std::vector<std::shared_ptr<Passenger> >::iterator iterator;
     typedef std::vector<std::shared_ptr<Passenger> >::const_iterator const_iterator;
@@ -309,6 +1327,184 @@ namespace asap {
     std::vector<std::shared_ptr<Passenger> > passengers_;
   };
 
+  ////////////////////////////////////////////////////////////
+  //
+  // Reads the passenger groups of a manifest one at a time. A
+  // manifest holds any number of groups, each starting with a line
+  // naming its travel category, followed by one line per passenger:
+  // name, seat type (window, aisle, none) and adult or minor. Case is
+  // ignored, empty lines and lines starting with '#' are skipped. A
+  // single group file, as read by PassengerGroup(file), is a manifest
+  // with one group.
+  //
+  // The input is read in chunks, tokens are string_views into the
+  // chunk, so memory is bounded by the chunk size, the longest line
+  // and the group at hand, however long the manifest is. Malformed
+  // lines throw a Flight::ParseError with line and column.
+  //
+  // Example:
+  //   ManifestReader r("manifest.asc"); // "-" reads std::cin
+  //   PassengerGroup g(TravelCategory::kEconomy);
+  //   while (r.next(g))
+  //     oceanic_815.checkin(g);
+
+  class ManifestReader {
+  public:
+    static const size_t default_chunk = 64 * 1024;
+    explicit ManifestReader(const std::string& file, size_t chunk = default_chunk);
+    explicit ManifestReader(std::istream& in, size_t chunk = default_chunk);
+    // replaces group by the next one, false at the end of the input
+    bool next(PassengerGroup& group);
+    // number of lines read so far
+    int line() const { return line_; }
+  private:
+    bool next_line(std::string_view& line);
+    bool category(std::string_view line);
+    std::unique_ptr<std::ifstream> file_;
+    std::istream* in_;
+    size_t chunk_;
+    std::vector<char> buffer_;
+    // unread part of buffer_
+    size_t first_, last_;
+    int line_;
+    // category line of the next group, when already read
+    bool pending_;
+    TravelCategory cat_;
+    int cat_line_;
+    std::string word_;
+  };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Latency histogram, with one bucket per power of two
+  // nanoseconds. Adding a sample is a few instructions; quantiles
+  // are those of the buckets, i.e. exact to within a factor of two.
+
+  class LatencyHistogram {
+  public:
+    static const int n_buckets = 48;
+    LatencyHistogram() : buckets_(), count_(0), total_ns_(0), max_ns_(0) { }
+    void add(uint64_t ns) {
+      // bucket b holds [2^(b-1), 2^b)
+      ++buckets_[std::min(ns ? 64 - __builtin_clzll(ns) : 0, n_buckets - 1)];
+      ++count_;
+      total_ns_ += ns;
+      max_ns_ = std::max(max_ns_, ns);
+    }
+    uint64_t count() const { return count_; }
+    double mean_ns() const { return count_ ? double(total_ns_) / count_ : 0; }
+    uint64_t max_ns() const { return max_ns_; }
+    // upper end of the bucket holding the q-quantile, at most max_ns
+    uint64_t quantile(double q) const;
+    LatencyHistogram& operator+=(const LatencyHistogram& h);
+  private:
+    // which reads the histograms of its thread slots
+    friend class StatsRegistry;
+    std::array<uint64_t, n_buckets> buckets_;
+    uint64_t count_, total_ns_, max_ns_;
+  };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // What check-in did: counters of the work done by the window
+  // search and of the results, the no. of operations of each kind,
+  // and latency histograms of Flight construction and of each kind
+  // of check-in. To keep the clock off the check-in path, only one
+  // operation in sample_every of each kind and flight is timed, the
+  // first one included. Flight::stats() has those of one flight,
+  // StatsRegistry those of the whole process. Configured with
+  // --disable-stats, nothing is counted or timed and all of them
+  // stay zero.
+  //
+  // Example:
+  //   Flight f("flight.asc");
+  //   ...
+  //   const Stats& s = f.stats();
+  //   std::cout << s.windows << " windows, p99 check-in "
+  //             << s.latency[Stats::kCheckinGroup].quantile(0.99) << " ns\n";
+
+  struct Stats {
+    enum Op { kLoad, kCheckinGroup, kCheckinPassenger, kCheckinSeat, kCheckinBatch };
+    static const int n_ops = 5;
+    static const uint64_t sample_every = 64;
+    struct Counters {
+      // candidate windows looked at
+      uint64_t windows = 0;
+      // windows not ruled out by the lower bound, whose passenger
+      // penalty was computed
+      uint64_t penalties = 0;
+      // groups matched to the seats of their window
+      uint64_t matches = 0;
+      // kOverbooked and kSeatUnavailable results
+      uint64_t overbooked = 0;
+      uint64_t seat_unavailable = 0;
+      Counters& operator+=(const Counters& c);
+      Counters operator-(const Counters& c) const;
+    };
+    Counters counters;
+    // operations of each kind, and the latencies of those timed
+    std::array<uint64_t, n_ops> ops{};
+    std::array<LatencyHistogram, n_ops> latency;
+    Stats& operator+=(const Stats& s);
+    static const char* name(Op op);
+  };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Process wide Stats. Each thread adds its operations to a slot
+  // of its own, without a lock: only that thread writes it, and
+  // total() sums the slots when it is called. Slots of threads that
+  // are gone are folded into one. reset() while other threads
+  // record may miss some of their operations.
+  //
+  // Example:
+  //   Stats s = StatsRegistry::instance().total();
+
+  class StatsRegistry {
+  public:
+    static StatsRegistry& instance();
+    // sum over all threads
+    Stats total() const;
+    void reset();
+    // one operation of the calling thread that did c, and if timed
+    // took ns
+    void record(Stats::Op op, bool timed, uint64_t ns, const Stats::Counters& c);
+  private:
+    StatsRegistry() { }
+    struct Slot;
+    static Stats read(const Slot& s);
+    mutable std::mutex lock_;
+    std::vector<Slot*> slots_;
+    Stats retired_;
+  };
+
+  ////////////////////////////////////////////////////////////
+  //
+  // Seat layout of an aircraft, with its penalty weights and the
+  // flight number of its file. It never changes once loaded, so one
+  // layout is shared by any number of flights, each of which holds
+  // only its own occupancy.
+  //
+  // Example:
+  //   auto layout = AircraftLayout::load("flight.asc");
+  //   Flight monday(layout, "OA 815"), tuesday(layout, "OA 817");
+
+  class AircraftLayout {
+  public:
+    // file is either a flight file or an image compiled from one,
+    // throws as Flight's constructor does
+    static std::shared_ptr<const AircraftLayout> load(const std::string& file);
+    const detail::SeatMap& seats() const { return seats_; }
+    const std::string& flight_number() const { return flight_number_; }
+    const detail::PenaltyWeights& penalties() const { return penalties_; }
+    int n_seats() const { return seats_.size(); }
+  private:
+    AircraftLayout() { }
+    detail::SeatMap seats_;
+    std::string flight_number_;
+    detail::PenaltyWeights penalties_;
+  };
+
   ////////////////////////////////////////////////////////////
   //
   // Flight class. Airplane information will be read from an input
@@ -331,8 +1527,120 @@ namespace asap {
     enum class AssignResult {kOk, kOverbooked, kSeatUnavailable};
     class FileNotFoundError : public std::exception { };
     class InputFileFormatError : public std::exception { };
+    // what is wrong with the flight or passenger file, and where
+    class ParseError : public InputFileFormatError {
+    public:
+      ParseError(int line, int column, const std::string& message);
+      int line() const { return line_; }
+      int column() const { return column_; }
+      const char* what() const noexcept { return what_.c_str(); }
+    private:
+      int line_;
+      int column_;
+      std::string what_;
+    };
+    // file is either a flight file or an image compiled from one
     explicit Flight(std::string file);
+    // A flight on a shared layout, by default with the flight number
+    // of its file. Only the occupancy is the flight's own: it starts
+    // as one bit per seat, and the table of who sits where grows a
+    // block of 64 seats at a time as they are taken.
+    explicit Flight(std::shared_ptr<const AircraftLayout> layout,
+		    std::string flight_number = std::string());
+    // compile a flight file into an image for faster loading
+    static void compile(const std::string& file, const std::string& image_file);
     void show();
+    // Write the seat map in a given format, to a stream or appended
+    // to a string. Nothing is allocated per seat, a stream is written
+    // in large blocks and not flushed.
+    void render(std::ostream& out, RenderFormat format = RenderFormat::kText) const;
+    void render(std::string& out, RenderFormat format = RenderFormat::kText) const;
+    // Seats by id, as Seat objects, and their travel category. Here
+    // and below, an id not in [0, n_seats()) throws std::out_of_range.
+    int n_seats() const { return seats_->size(); }
+    Seat seat(int id) const;
+    TravelCategory category(int id) const { return seats_->cabin_of(seat_id(id)).cat; }
+    // How groups are matched to the seats picked for them
+    void set_assign_mode(AssignMode mode) { assign_mode_ = mode; }
+    AssignMode get_assign_mode() const { return assign_mode_; }
+    // Where groups are looked for. kRuns keeps a detail::FreeRuns
+    // index of the runs of empty seats, at some cost per check-in,
+    // and seats each group within one run if it fits one.
+    void set_placement_mode(PlacementMode mode);
+    PlacementMode get_placement_mode() const { return placement_; }
+    // Which occupied seats a group pays neighbor_seat_occupied for,
+    // see NeighborMode
+    void set_neighbor_mode(NeighborMode mode) { neighbor_mode_ = mode; }
+    NeighborMode get_neighbor_mode() const { return neighbor_mode_; }
+    // No. of occupied neighbours of a seat, of a kind
+    int occupied_neighbors(int id, Neighbor kind) const;
+    // Center of mass of the passengers of a cabin, and of the whole
+    // aircraft, for load control; up to date after every check-in,
+    // cancellation and move. The balance penalty weight scores
+    // windows by them.
+    const LoadBalance& balance(TravelCategory cat) const {
+      return balance_[static_cast<int>(cat)];
+    }
+    LoadBalance balance() const;
+    // Until deadline, look for a better seating of the passengers
+    // the window search seated, with detail::LocalSearch, and move
+    // them there. Passengers who chose their seat, were moved by
+    // move(), or were restored from a journal stay where they are.
+    // Groups may end up apart where that costs less than what it
+    // saves. The moves are journaled as one check-in.
+    struct ReoptimizeResult {
+      // total_penalty() before and after
+      double before;
+      double after;
+      // moves tried, and those kept
+      uint64_t tried;
+      uint64_t kept;
+    };
+    ReoptimizeResult reoptimize(std::chrono::steady_clock::time_point deadline);
+    // Sum of what each group of passengers pays for its seats, as
+    // reoptimize scores it
+    double total_penalty() const;
+    // Penalty weights, as read from the flight file
+    void set_penalties(const detail::PenaltyWeights& penalties);
+    const detail::PenaltyWeights& get_penalties() const { return penalties_; }
+    // Score candidate windows of large cabins on up to n_threads
+    // threads, see WindowScorer::set_parallel. Seating is the same as
+    // with the default, serial scoring.
+    void set_parallel(unsigned n_threads,
+		      size_t min_windows = detail::default_parallel_windows) {
+      scorer_.set_parallel(n_threads, min_windows);
+    }
+    // Journal check-ins to file, so that the seating survives a
+    // crash. Every check-in is appended as one record holding the
+    // seats it took and their passengers; a background thread writes
+    // and syncs the records, many at a time, so check-in does not
+    // wait for the disk. Every snapshot_every check-ins (never if 0),
+    // a snapshot of all seated passengers is written to file + ".snap"
+    // and the journal is emptied.
+    // If file already holds a journal, and the flight is still empty,
+    // the flight is first restored from the snapshot and the records
+    // after it. A flight with passengers starts a new journal, with a
+    // snapshot of them. Bad files throw InputFileFormatError, a torn
+    // last record is dropped.
+    void open_journal(const std::string& file, size_t snapshot_every = 0);
+    void close_journal() { journal_.reset(); }
+    // Block until every journaled check-in is on disk
+    void sync_journal();
+    // Write a snapshot now, and empty the journal. The seated
+    // passengers are serialized here, on the calling thread, at about
+    // 75 ns each, e.g. 2.3 ms for 30000; the writer thread only writes
+    // the image. A periodic snapshot pauses the check-in that is due
+    // for it just so.
+    // Names are journaled and snapshotted up to their first 65535
+    // bytes.
+    void snapshot();
+    // Keep passengers in a detail::PassengerArena rather than as
+    // shared_ptrs. Passengers already checked in are moved over. Seat
+    // then hands out copies of the passengers, made on request.
+    void set_arena(bool on);
+    bool get_arena() const { return use_arena_; }
+    // Counters and latencies of this flight, see Stats
+    Stats stats() const;
     // Check in a group of passengers
     AssignResult checkin(PassengerGroup&);
     // Check in an idividual passenger
@@ -341,24 +1649,250 @@ namespace asap {
     // Check in an idividual passenger, on a given seat
     AssignResult checkin(TravelCategory, const std::string& name,
 			 bool is_minor, const std::string& seat_no);
+    // Free a seat, for a cancellation or a no-show. False if there is
+    // no such seat, or nobody sits there.
+    bool cancel(const std::string& seat_no);
+    // Move the passenger on seat from to the empty seat to, in the
+    // same travel category
+    AssignResult move(const std::string& from, const std::string& to);
+    // Check in many groups at once. Groups are seated largest and
+    // most restrictive first, rather than in the order given, or
+    // with as_given in the order given. The i-th result belongs to
+    // the i-th group.
+    std::vector<AssignResult> checkin_batch(PassengerGroup* groups, size_t n,
+					    bool as_given = false);
+    std::vector<AssignResult> checkin_batch(std::vector<PassengerGroup>& groups,
+					    bool as_given = false) {
+      return checkin_batch(groups.data(), groups.size(), as_given);
+    }
+    // Ids of the seats the last check-in took, one per passenger in
+    // the order of its group after sorting, -1 for those not seated.
+    // After checkin_batch, those of each group in the order given.
+    const std::vector<int>& last_seats() const { return last_seats_; }
+    // Label of a seat, e.g. "12A"
+    std::string seat_label(int id) const { return seats_->label(seat_id(id)); }
+    // the layout, shared with other flights
+    const std::shared_ptr<const AircraftLayout>& layout() const { return layout_; }
   private:
-    void init(std::ifstream&);
-    // no. of rows in each category
-    std::map<TravelCategory, int> rows_;
-    // the row no.s being an emergency exit rows
-    std::map<TravelCategory, std::list<int> > emergency_;
-    // the numering offest to translate from abs. row number
-    // to index in seats_by_row
-    std::map<TravelCategory, int> offset_;
-    // emty seats, sorted by id
-    std::map<TravelCategory, std::vector<std::shared_ptr<Seat> > > empty_seats_by_id_;
-    // all seats, by row number, in ascending label order
-    std::map<TravelCategory, std::vector<std::deque<std::shared_ptr<Seat> > > > seats_by_row_;
-    // where the center of mass should be
-    std::map<TravelCategory, int> center_at_;
+    // id, if there is a seat with that id
+    int seat_id(int id) const {
+      if (id < 0 || id >= n_seats())
+	throw std::out_of_range("no seat with id " + std::to_string(id));
+      return id;
+    }
+    // an empty flight on layout
+    void init(std::shared_ptr<const AircraftLayout> layout, std::string flight_number);
+    // render to a writer of src/render.cc
+    template <typename Sink>
+    void render_to(Sink& out, RenderFormat format) const;
+    // name of the passenger on an occupied seat
+    std::string_view passenger_name(int id) const;
+    // seat the passengers in [first, last), sorted most restrictive
+    // first, in the best window of empty seats
+    template <typename Iter>
+    AssignResult place(TravelCategory, Iter first, Iter last);
+    // feed the empty seats of a category to scorer_
+    void fill_scorer(TravelCategory);
+    // feed the seats in [first, last) to scorer_, all empty
+    void fill_scorer(int first, int last);
+    // intrinsic cost of an empty seat, for scorer_
+    double seat_cost(int id) const;
+    // with a balance weight, turn on scorer_'s balance term for a
+    // cabin, and push its seats with their positions
+    void set_scorer_balance(const detail::SeatMap::Cabin& c);
+    void push_seat(const detail::SeatMap::Cabin& c, int id);
+    // seat the passengers in [first, last) in the best window within
+    // a run of empty seats, false if no run holds them all
+    template <typename Iter>
+    bool take_run(TravelCategory, Iter first, Iter last);
+    // PlacementMode::kRuns: runs_ indexes the empty seats
+    PlacementMode placement_;
+    detail::FreeRuns runs_;
+    std::vector<std::pair<int, int> > candidates_;
+    // seat the passengers in the best window known to scorer_,
+    // returns the offset of that window
+    template <typename Iter>
+    size_t take_window(Iter first, Iter last);
+    // seat the passengers in the window of scorer_ at offset
+    template <typename Iter>
+    void take_window(Iter first, Iter last, size_t offset);
+    // the seat layout, seats_ is that of layout_
+    std::shared_ptr<const AircraftLayout> layout_;
+    const detail::SeatMap* seats_;
+    detail::Bitmap occupied_;
+    // who sits where; the handles index into passengers_, or into
+    // arena_ if use_arena_ is set
+    detail::OccupantTable occupants_;
+    // the passengers seated, with the slots of those gone in free_
+    std::vector<std::shared_ptr<Passenger> > passengers_;
+    std::vector<unsigned> free_;
+    detail::PassengerArena arena_;
+    bool use_arena_;
+    // no. of empty seats in each category
+    std::array<int, 3> n_empty_;
+    // by travel category, kept up to date by mark_taken and vacate
+    std::array<LoadBalance, 3> balance_;
+    // the groups of occupants_ are those seated by take_window,
+    // numbered from 1; 0 for seats taken otherwise, which
+    // reoptimize keeps
+    uint32_t next_group_;
+    std::vector<int> last_seats_;
+    void fill_search(detail::LocalSearch& search) const;
+    NeighborMode neighbor_mode_;
+    void occupy(int id, const std::shared_ptr<Passenger>& p);
+    // p may be moved from
+    void occupy(int id, Passenger* p);
+    // bookkeeping of occupy, once the handle of id is set
+    void mark_taken(int id);
+    // the passenger of id leaves its seat, but keeps its handle for
+    // another, or gives it up with release
+    void vacate(int id);
+    void release(int id);
+    // journal of check-ins, if any: the seats taken by occupy are
+    // collected by journal_seat, and written out as one record by
+    // journal_commit at the end of each check-in
+    detail::JournalRef journal_;
+    void journal_seat(int id);
+    void journal_vacate(int id);
+    void journal_commit();
+    std::string snapshot_image(uint64_t seq) const;
     // descriptive flight number
     std::string flight_number_;
+    // greedy or optimal matching within the chosen seats
+    AssignMode assign_mode_;
+    detail::PenaltyWeights penalties_;
+    // counted by Flight, the window counts are kept by scorer_; all
+    // zero with --disable-stats, which leaves the layout alone
+    Stats stats_;
+    // times an operation, and records it in stats_ and StatsRegistry
+    class OpTimer;
+    Stats::Counters counters() const;
+    // scratch space for check-in, reused to avoid allocations
+    detail::WindowScorer scorer_;
+    std::vector<int> seat_of_;
   };
+
+  namespace detail { // template implementations
+    template <typename Iter>
+    void sort_most_restrictive_first (Iter first, Iter last) {
+      std::sort(first, last,
+		[](const std::shared_ptr<Passenger>& p, 
+		   const std::shared_ptr<Passenger>& q){
+		  return std::make_pair(!p->is_minor(), p->get_seat_type())
+		    < std::make_pair(!q->is_minor(), q->get_seat_type()); });
+    }
+
+    template <typename Policy>
+    double penalty (const std::shared_ptr<Seat>& s, const std::shared_ptr<Passenger>& p,
+		    const Policy& policy) {
+      return penalty(s->get_seat_type(), s->is_emergency_exit_seat(),
+		     p->get_seat_type(), p->is_minor(), policy);
+    }
+
+    template <typename Iter, typename Policy>
+    std::pair<Iter, double> find_best_match (Iter first, Iter last,
+					     const std::shared_ptr<Passenger>& p,
+					     const Policy& policy) {
+      auto iter = std::min_element(first, last,
+				   [&p, &policy](const std::shared_ptr<Seat>& s,
+						 const std::shared_ptr<Seat>& t){
+				     return penalty(s, p, policy) < penalty(t, p, policy); });
+      return std::make_pair(iter, penalty(*iter, p, policy));
+    }
+
+    template <typename Iter1, typename Iter2, typename Policy>
+    double match(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		 const Policy& policy){
+      double result = 0;
+      int count = 0;
+      int min_id = std::numeric_limits<int>::max();
+      int max_id = 0;
+      while (firstp != lastp && firsts != lasts){
+	auto j = find_best_match(firsts, lasts, *firstp, policy);
+	const double& score = j.second;
+	const std::shared_ptr<Seat>& seat_ptr = *(j.first);
+	// update scoring for match
+	result += score;
+	result += seat_ptr->get_intrinsic_cost();
+	// update max/min
+	if (seat_ptr->get_id() < min_id) min_id = seat_ptr->get_id();
+	if (seat_ptr->get_id() > max_id) max_id = seat_ptr->get_id();
+	std::swap(*(j.first), *firsts);
+	++firsts;
+	++firstp;
+	++count;
+      }
+      // penalty for non-contiguous seating
+      result += policy.non_contiguous * (max_id - min_id - count + 1);
+      return result;
+    }
+
+    // this works optimal only if [firstp, lastp) is
+    // sorted using sort_most_restrictive_first
+    template <typename Iter1, typename Iter2, typename Policy>
+    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		const Policy& policy){
+#ifdef DEBUG
+      double cost = 0;
+      int count = 0;
+      int min_id = std::numeric_limits<int>::max();
+      int max_id = 0;
+#endif
+      while (firstp != lastp && firsts != lasts){
+	auto j = find_best_match(firsts, lasts, *firstp, policy);
+	const std::shared_ptr<Seat>& seat_ptr = *(j.first);
+#ifdef DEBUG
+	cost += j.second;
+	cost += seat_ptr->get_intrinsic_cost();
+	++count;
+	std::cout << "(" << (*firstp)->get_name() << ","
+		  << detail::CatMap::instance().desc((*firstp)->get_seat_type()) 
+		  << "," << (*firstp)->is_minor() << ") -> ";
+	std::cout << seat_ptr->get_info() << " penalty: " << j.second << std::endl;
+	if (seat_ptr->get_id() < min_id) min_id = seat_ptr->get_id();
+	if (seat_ptr->get_id() > max_id) max_id = seat_ptr->get_id();
+#endif
+	seat_ptr->set_passenger(*firstp);
+	std::swap(*(j.first), *firsts);
+	++firsts;
+	++firstp;
+      }
+#ifdef DEBUG
+      // penalty for non-contiguous seating
+      cost += policy.non_contiguous * (max_id - min_id - count + 1);
+      std::cout << "max = " << max_id << ", min = " << min_id << ", count = " << count << std::endl;
+      std::cout << "TOTAL PENALTY: " << cost << std::endl;
+#endif
+    }
+
+    template <typename Iter1, typename Iter2>
+    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts,
+		TransportPlan plan){
+      for (; firstp != lastp && firsts != lasts; ++firstp) {
+	const int pc = passenger_class((*firstp)->get_seat_type(),
+				       (*firstp)->is_minor());
+	for (Iter2 s = firsts; s != lasts; ++s) {
+	  int& n = plan.flow[pc][seat_class((*s)->get_seat_type(),
+					    (*s)->is_emergency_exit_seat())];
+	  if (!n) continue;
+	  --n;
+	  (*s)->set_passenger(*firstp);
+	  std::swap(*s, *firsts);
+	  ++firsts;
+	  break;
+	}
+      }
+    }
+
+    template <typename Iter>
+    void WindowScorer::set_group(Iter first, Iter last) {
+      group_.fill(0);
+      group_size_ = 0;
+      for (; first != last; ++first, ++group_size_)
+	++group_[passenger_class((*first)->get_seat_type(),
+				 (*first)->is_minor())];
+    }
+  } // namespace detail
 }
 
 #endif // _FLIGHT_H_
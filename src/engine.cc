@@ -0,0 +1,254 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        MULTI-FLIGHT ENGINE
+
+#include <engine.hpp>
+
+namespace asap {
+  CheckinEngine::CheckinEngine(size_t n_workers)
+    : queued_(0), idle_(0), pending_(0), stop_(false), max_batch_(32) {
+    if (!n_workers)
+      n_workers = 1;
+    workers_.resize(n_workers);
+    for (size_t i = 0; i < n_workers; ++i)
+      workers_[i].thread = std::thread([this, i]() { run(i); });
+  }
+
+  CheckinEngine::~CheckinEngine() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      stop_ = true;
+    }
+    idle_cv_.notify_all();
+    for (auto& w : workers_)
+      w.thread.join();
+    for (Request* r = spare_.take(); r; ) {
+      Request* next = r->next;
+      delete r;
+      r = next;
+    }
+  }
+
+  CheckinEngine::FlightId CheckinEngine::add_flight(const std::string& file) {
+    return add_flight(std::unique_ptr<Flight>(new Flight(file)));
+  }
+
+  CheckinEngine::FlightId CheckinEngine::add_flight(std::unique_ptr<Flight> flight) {
+    FlightId id = slots_.size();
+    slots_.emplace_back();
+    Slot& s = slots_.back();
+    s.flight = std::move(flight);
+    s.owner = id % workers_.size();
+    s.backlog = nullptr;
+    s.scheduled = false;
+    return id;
+  }
+
+  std::future<Flight::AssignResult>
+  CheckinEngine::checkin(FlightId id, PassengerGroup g) {
+    return submit(id, [g](Flight& f) mutable { return f.checkin(g); });
+  }
+
+  std::future<Flight::AssignResult>
+  CheckinEngine::checkin(FlightId id, TravelCategory cat, std::string name,
+			 SeatType type, bool is_minor) {
+    return submit(id, [=](Flight& f) { return f.checkin(cat, name, type, is_minor); });
+  }
+
+  std::future<Flight::AssignResult>
+  CheckinEngine::checkin(FlightId id, TravelCategory cat, std::string name,
+			 bool is_minor, std::string seat_no) {
+    return submit(id, [=](Flight& f) { return f.checkin(cat, name, is_minor, seat_no); });
+  }
+
+  std::future<std::vector<Flight::AssignResult> >
+  CheckinEngine::checkin_batch(FlightId id, std::vector<PassengerGroup> groups) {
+    return submit(id, [groups](Flight& f) mutable { return f.checkin_batch(groups); });
+  }
+
+  std::future<CheckinEngine::Reply>
+  CheckinEngine::checkin_async(FlightId id, PassengerGroup g) {
+    auto promise = std::make_shared<std::promise<Reply> >();
+    std::future<Reply> result = promise->get_future();
+    checkin_async(id, std::move(g), [promise](Reply r) {
+	promise->set_value(std::move(r)); });
+    return result;
+  }
+
+  void CheckinEngine::checkin_async(FlightId id, PassengerGroup g, ReplyHandler done) {
+    Request* r = allocate();
+    r->group.emplace(std::move(g));
+    r->done = std::move(done);
+    post(id, r);
+  }
+
+  void CheckinEngine::wait() {
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_cv_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+  void CheckinEngine::post(FlightId id, Task task) {
+    Request* r = allocate();
+    r->task = std::move(task);
+    post(id, r);
+  }
+
+  CheckinEngine::Request* CheckinEngine::allocate() {
+    // nodes this thread took back, of any engine, freed when the
+    // thread exits
+    struct Cache {
+      Request* list = nullptr;
+      ~Cache() {
+	while (list) {
+	  Request* next = list->next;
+	  delete list;
+	  list = next;
+	}
+      }
+    };
+    static thread_local Cache cache;
+    if (!cache.list)
+      cache.list = spare_.take();
+    if (Request* r = cache.list) {
+      cache.list = r->next;
+      return r;
+    }
+    return new Request;
+  }
+
+  void CheckinEngine::recycle(Request* request) {
+    request->task = nullptr;
+    request->group.reset();
+    request->done = nullptr;
+    spare_.push(request);
+  }
+
+  void CheckinEngine::post(FlightId id, Request* request) {
+    Slot& s = slots_.at(id);
+    ++pending_;
+    s.inbox.push(request);
+    // whoever sets scheduled queues the flight with its owner
+    if (!s.scheduled.exchange(true))
+      enqueue(s.owner, &s);
+  }
+
+  void CheckinEngine::enqueue(size_t worker, Slot* slot) {
+    {
+      Worker& w = workers_[worker];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      w.queue.push_back(slot);
+      ++queued_;
+    }
+    // a worker counts itself idle before it looks at queued_, so
+    // either it sees the flight or it is seen here; it waits under
+    // the idle lock, which we pass through so it cannot miss the call
+    if (!idle_)
+      return;
+    { std::lock_guard<std::mutex> lock(idle_mutex_); }
+    idle_cv_.notify_one();
+  }
+
+  CheckinEngine::Slot* CheckinEngine::next(size_t worker) {
+    // own queue from the front, victims from the back
+    for (size_t k = 0; k < workers_.size(); ++k) {
+      Worker& w = workers_[(worker + k) % workers_.size()];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      if (w.queue.empty())
+	continue;
+      Slot* s;
+      if (k == 0) {
+	s = w.queue.front();
+	w.queue.pop_front();
+      }
+      else {
+	s = w.queue.back();
+	w.queue.pop_back();
+      }
+      --queued_;
+      return s;
+    }
+    return 0;
+  }
+
+  void CheckinEngine::seat(Flight& flight, std::vector<Request*>& batch,
+			   std::vector<PassengerGroup>& groups) {
+    const std::vector<int>& ids = flight.last_seats();
+    if (batch.size() == 1) {
+      // nothing to batch with, and Flight::checkin allocates less
+      const Flight::AssignResult result = flight.checkin(groups[0]);
+      batch[0]->done(Reply{result, std::move(groups[0]), ids});
+      return;
+    }
+    const std::vector<Flight::AssignResult> results = flight.checkin_batch(groups, true);
+    size_t k = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const size_t n = groups[i].size();
+      Reply reply = {results[i], std::move(groups[i]),
+		     std::vector<int>(ids.begin() + k, ids.begin() + k + n)};
+      k += n;
+      batch[i]->done(std::move(reply));
+    }
+  }
+
+  void CheckinEngine::run(size_t worker) {
+    for (;;) {
+      Slot* s = next(worker);
+      if (!s) {
+	std::unique_lock<std::mutex> lock(idle_mutex_);
+	++idle_;
+	idle_cv_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+	--idle_;
+	if (stop_ && queued_ == 0)
+	  return;
+	continue;
+      }
+      if (turn(s))
+	enqueue(worker, s);
+    }
+  }
+
+  bool CheckinEngine::turn(Slot* s) {
+    std::vector<Request*>& batch = s->batch;
+    std::vector<PassengerGroup>& groups = s->groups;
+    // scheduled stays set while we work, so nobody else runs this
+    // flight; requests arriving meanwhile stay in the inbox. At most
+    // max_batch_ requests are run per turn, the rest wait in the
+    // backlog for the flight's next turn.
+    if (!s->backlog)
+      s->backlog = s->inbox.take();
+    Request* r = s->backlog;
+    size_t n = 0;
+    while (r && n < max_batch_) {
+      if (r->task) {
+	r->task(*s->flight);
+	Request* next = r->next;
+	recycle(r);
+	r = next;
+	++n;
+	continue;
+      }
+      // a run of group check-ins is seated as one batch
+      batch.clear();
+      groups.clear();
+      for (; r && !r->task && n < max_batch_; r = r->next, ++n) {
+	batch.push_back(r);
+	groups.push_back(std::move(*r->group));
+      }
+      seat(*s->flight, batch, groups);
+      for (Request* b : batch)
+	recycle(b);
+    }
+    s->backlog = r;
+    // a producer that saw scheduled still set has pushed already,
+    // so either it is seen here or the flight is queued by it
+    s->scheduled = false;
+    const bool more = (s->backlog || !s->inbox.empty()) && !s->scheduled.exchange(true);
+    if (pending_.fetch_sub(n) == n) {
+      std::lock_guard<std::mutex> lock(done_mutex_);
+      done_cv_.notify_all();
+    }
+    return more;
+  }
+}
@@ -6,64 +6,48 @@
 // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
 // \date Mon Oct  7 13:14:26 2013
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <flight.hpp>
-#include <regex>
+#include <cctype>
+#include <chrono>
+#include <thread>
+
+// counting for Flight::stats, compiled out by --disable-stats
+#ifdef ASAP_NO_STATS
+#define ASAP_COUNT(counter, n)
+#else
+#define ASAP_COUNT(counter, n) ((counter) += (n))
+#endif
 
 namespace asap {
   namespace detail {
-    double penalty (const std::shared_ptr<Seat>& s, const std::shared_ptr<Passenger>& p) {
-      double result = 0;
-      if (p->get_seat_type() != s->get_seat_type() 
-	  && p->get_seat_type() !=  SeatType::kOther)
-	result += wrong_seat_penalty;
-      if (p->is_minor() && s->is_emergency_exit_seat())
-	result += wrong_sec_penalty;
-      return result;
+    bool PenaltyWeights::set(const std::string& name, double value) {
+      if (name == "wrong_seat") wrong_seat = value;
+      else if (name == "wrong_sec") wrong_sec = value;
+      else if (name == "neighbor_seat_occupied") neighbor_seat_occupied = value;
+      else if (name == "weight") weight = value;
+      else if (name == "non_contiguous") non_contiguous = value;
+      else if (name == "balance") balance = value;
+      else if (name == "neighbor_across_aisle") neighbor_across_aisle = value;
+      else if (name == "neighbor_front_back") neighbor_front_back = value;
+      else return false;
+      return true;
     }
-    template <typename Iter>
-    void sort_most_restrictive_first (Iter first, Iter last) {
-      std::sort(first, last,
-		[](const std::shared_ptr<Passenger>& p, 
-		   const std::shared_ptr<Passenger>& q){
-		  return std::make_pair(!p->is_minor(), p->get_seat_type())
-		    < std::make_pair(!q->is_minor(), q->get_seat_type()); });
-    }
-    template <typename Iter>
-    std::pair<Iter, double> find_best_match (Iter first, Iter last,
-					     const std::shared_ptr<Passenger>& p) {
-      auto iter = std::min_element(first, last,
-				   [&p](const std::shared_ptr<Seat>& s,
-					const std::shared_ptr<Seat>& t){
-				     return penalty(s, p) < penalty(t, p); });
-      return std::make_pair(iter, penalty(*iter, p));
-    }
-
-    template <typename Iter1, typename Iter2>
-    double match(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts){
-      double result = 0;
-      int count = 0;
-      int min_id = std::numeric_limits<int>::max();
-      int max_id = 0;
-      while (firstp != lastp && firsts != lasts){
-	auto j = find_best_match(firsts, lasts, *firstp);
-	const double& score = j.second;
-	const std::shared_ptr<Seat>& seat_ptr = *(j.first);
-	// update scoring for match
-	result += score;
-	result += seat_ptr->get_intrinsic_cost();
-	// update max/min
-	if (seat_ptr->get_id() < min_id) min_id = seat_ptr->get_id();
-	if (seat_ptr->get_id() > max_id) max_id = seat_ptr->get_id();
-	std::swap(*(j.first), *firsts);
-	++firsts;
-	++firstp;
-	++count;
-      }
-      // penalty for non-contiguous seating
-      result += detail::non_contiguous_penalty * (max_id - min_id - count + 1);
-      return result;
+
+    bool PenaltyWeights::is_default() const {
+      return wrong_seat == DefaultPenalties::wrong_seat
+	&& wrong_sec == DefaultPenalties::wrong_sec
+	&& neighbor_seat_occupied == DefaultPenalties::neighbor_seat_occupied
+	&& weight == DefaultPenalties::weight
+	&& non_contiguous == DefaultPenalties::non_contiguous
+	&& balance == DefaultPenalties::balance
+	&& neighbor_across_aisle == DefaultPenalties::neighbor_across_aisle
+	&& neighbor_front_back == DefaultPenalties::neighbor_front_back;
     }
-    
+
     std::string CatMap::desc(const SeatType& t) const {
       auto i = seat_map_.find(t);
       if (i != seat_map_.end())
@@ -110,245 +94,1306 @@ namespace asap {
       seat_map_[SeatType::kOther] = "";
     }
     
-    // this works optimal only if [firstp, lastp) is
-    // sorted using sort_most_restrictive_first
-    template <typename Iter1, typename Iter2>
-    void assign(Iter1 firstp, Iter1 lastp, Iter2 firsts, Iter2 lasts){
-#ifdef DEBUG
-      double cost = 0;
-      int count = 0;
-      int min_id = std::numeric_limits<int>::max();
-      int max_id = 0;
-#endif
-      while (firstp != lastp && firsts != lasts){
-	auto j = find_best_match(firsts, lasts, *firstp);
-	const double& score = j.second;
-	const std::shared_ptr<Seat>& seat_ptr = *(j.first);
-#ifdef DEBUG
-	cost += score;
-	cost += seat_ptr->get_intrinsic_cost();
-	++count;
-	std::cout << "(" << (*firstp)->get_name() << ","
-		  << detail::CatMap::instance().desc((*firstp)->get_seat_type()) 
-		  << "," << (*firstp)->is_minor() << ") -> ";
-	std::cout << seat_ptr->get_info() << " penalty: " << j.second << std::endl;
-	if (seat_ptr->get_id() < min_id) min_id = seat_ptr->get_id();
-	if (seat_ptr->get_id() > max_id) max_id = seat_ptr->get_id();
-#endif
-	seat_ptr->set_passenger(*firstp);
-	std::swap(*(j.first), *firsts);
-	++firsts;
-	++firstp;
+    void solve_transport(const std::array<int, n_passenger_classes>& supply,
+			 const std::array<int, n_seat_classes>& demand,
+			 const double (&cost)[n_passenger_classes][n_seat_classes],
+			 TransportPlan& plan) {
+      // node 0 is the source, then passenger classes, seat classes
+      // and the sink
+      const int n = 2 + n_passenger_classes + n_seat_classes;
+      const int src = 0, sink = n - 1, p0 = 1, s0 = 1 + n_passenger_classes;
+      const double inf = std::numeric_limits<double>::max();
+      int cap[n][n] = {};
+      double w[n][n] = {};
+      for (int pc = 0; pc < n_passenger_classes; ++pc) {
+	cap[src][p0 + pc] = supply[pc];
+	for (int sc = 0; sc < n_seat_classes; ++sc) {
+	  cap[p0 + pc][s0 + sc] = supply[pc];
+	  w[p0 + pc][s0 + sc] = cost[pc][sc];
+	  w[s0 + sc][p0 + pc] = -cost[pc][sc];
+	}
+      }
+      for (int sc = 0; sc < n_seat_classes; ++sc)
+	cap[s0 + sc][sink] = demand[sc];
+      for (auto& row : plan.flow)
+	std::fill(row, row + n_seat_classes, 0);
+      plan.cost = 0;
+      while (true) {
+	// cheapest augmenting path, Bellman-Ford
+	double dist[n];
+	int prev[n];
+	std::fill(dist, dist + n, inf);
+	dist[src] = 0;
+	for (bool changed = true; changed; ) {
+	  changed = false;
+	  for (int u = 0; u < n; ++u) {
+	    if (dist[u] == inf) continue;
+	    for (int v = 0; v < n; ++v)
+	      if (cap[u][v] > 0 && dist[u] + w[u][v] < dist[v] - 1e-9) {
+		dist[v] = dist[u] + w[u][v];
+		prev[v] = u;
+		changed = true;
+	      }
+	  }
+	}
+	if (dist[sink] == inf)
+	  break;
+	int f = std::numeric_limits<int>::max();
+	for (int v = sink; v != src; v = prev[v])
+	  f = std::min(f, cap[prev[v]][v]);
+	for (int v = sink; v != src; v = prev[v]) {
+	  const int u = prev[v];
+	  cap[u][v] -= f;
+	  cap[v][u] += f;
+	  if (u >= p0 && u < s0 && v >= s0 && v < sink)
+	    plan.flow[u - p0][v - s0] += f;
+	  else if (v >= p0 && v < s0 && u >= s0 && u < sink)
+	    plan.flow[v - p0][u - s0] -= f;
+	}
+	plan.cost += f * dist[sink];
       }
-#ifdef DEBUG
-      // penalty for non-contiguous seating
-      cost += max_id - min_id - count + 1;
-      std::cout << "max = " << max_id << ", min = " << min_id << ", count = " << count << std::endl;
-      std::cout << "TOTAL PENALTY: " << cost << std::endl;
-#endif
     }
-  } // namespace detail
-  
-  PassengerGroup::PassengerGroup(const std::string& file){
-    std::ifstream inf(file);
-    std::string tmp;
-    std::string name;
-    SeatType st;
-    detail::get_lower(inf, tmp);
-    cat_ = detail::CatMap::instance().cat(tmp);
-    while (inf.good()) {
-      inf >> name;
-      detail::get_lower(inf, tmp);
-      st = detail::CatMap::instance().type(tmp);
-      detail::get_lower(inf, tmp);
-      bool is_minor = tmp == "minor";
-      push(name, st, is_minor);
+
+    SlicePool& SlicePool::instance() {
+      // never destroyed, its threads wait for work until exit
+      static SlicePool* p = new SlicePool;
+      return *p;
+    }
+
+    void SlicePool::run(size_t n, void (*call)(void*, size_t), void* f) {
+      if (n < 2) {
+	if (n)
+	  call(f, 0);
+	return;
+      }
+      // slice 0 is the caller's
+      Job job = {call, f, n, 1, 1};
+      {
+	std::lock_guard<std::mutex> lock(lock_);
+	while (threads_.size() < n - 1)
+	  threads_.emplace_back([this]() { work(); });
+	jobs_.push_back(&job);
+      }
+      for (size_t t = 1; t < n; ++t)
+	work_cv_.notify_one();
+      call(f, 0);
+      std::unique_lock<std::mutex> lock(lock_);
+      while (job.next < n) {
+	const size_t t = job.next++;
+	if (job.next == n)
+	  jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+	lock.unlock();
+	call(f, t);
+	lock.lock();
+	++job.done;
+      }
+      done_cv_.wait(lock, [&job]() { return job.done == job.n; });
+    }
+
+    void SlicePool::work() {
+      std::unique_lock<std::mutex> lock(lock_);
+      for (;;) {
+	work_cv_.wait(lock, [this]() { return !jobs_.empty(); });
+	Job* job = jobs_.front();
+	const size_t t = job->next++;
+	if (job->next == job->n)
+	  jobs_.pop_front();
+	lock.unlock();
+	job->call(job->f, t);
+	lock.lock();
+	if (++job->done == job->n)
+	  done_cv_.notify_all();
+      }
+    }
+
+    WindowScorer::WindowScorer()
+      : balance_(false), group_size_(0), mode_(AssignMode::kGreedy), n_threads_(1),
+	min_windows_(default_parallel_windows), n_windows_(0), n_penalties_(0),
+	id_neighbors_(true) {
+      group_.fill(0);
+      set_policy(weights_);
+      clear();
     }
-  }
 
-  void Flight::init (std::ifstream& file) {
-    TravelCategory cat;
-    static std::regex re_ws("\\W+"); // sarch for whitepace -- separating seats
-    static std::regex re_comma(","); // sarch for commas -- separating seat
-    // groups
-    int total_rows = 1; // start seat numbering with one
-    std::string tmp;
-    std::map<TravelCategory, std::list<detail::SeatCreator> > seat_creators;
-    while (file.good()) {
-      detail::get_lower(file, tmp);
-      if (detail::CatMap::instance().is_valid_cat(tmp))
-	cat = detail::CatMap::instance().cat(tmp);
-      else if (tmp == "rows"){
-	file >> rows_[cat];
-	offset_[cat] = total_rows;
-	total_rows += rows_[cat];
-      }
-      else if (tmp == "emergency") {
-	int tmpi;
-	file >> tmpi;
-	emergency_[cat].push_back(tmpi);
-      }
-      else if (tmp == "seats"){
-	std::getline(file, tmp);
-	for(std::sregex_token_iterator i(tmp.begin(), tmp.end(), re_comma, -1), 
-	      end; i != end; ++i){
-	  std::list<detail::SeatCreator> group;
-	  for(std::sregex_token_iterator j(i->first, i->second, re_ws, -1); j != end; ++j)
-	    if (j->first != j->second) // avoid extra white space
-	      group.push_back(detail::SeatCreator(*j));
-	  // mark first and last place in group as aisle
-	  group.front().set_type(SeatType::kAisle); 
-	  group.back().set_type(SeatType::kAisle);
-	  seat_creators[cat].splice(seat_creators[cat].end(), group);
+    void WindowScorer::set_policy(const PenaltyWeights& policy) {
+      weights_ = policy;
+      for (int pc = 0; pc < n_passenger_classes; ++pc)
+	for (int sc = 0; sc < n_seat_classes; ++sc)
+	  pen_[pc][sc] = penalty(static_cast<SeatType>(sc / 2), sc % 2,
+				 static_cast<SeatType>(pc % 3), pc < 3, policy);
+      for (int pc = 0; pc < n_passenger_classes; ++pc) {
+	std::fill(rank_[pc], rank_[pc] + 16, 0);
+	for (int sc = 0; sc < n_seat_classes; ++sc)
+	  for (int o = 0; o < n_seat_classes; ++o)
+	    // count distinct lower penalties
+	    if (pen_[pc][o] < pen_[pc][sc]
+		&& std::find(pen_[pc], pen_[pc] + o, pen_[pc][o]) == pen_[pc] + o)
+	      ++rank_[pc][sc];
+      }
+    }
+
+    void WindowScorer::clear() {
+      ids_.clear();
+      classes_.clear();
+      cost_.assign(1, 0);
+      count_.assign(1, class_count());
+      taken_.clear();
+      n_taken_ = 0;
+      balance_ = false;
+    }
+
+    void WindowScorer::set_balance(int64_t row_moment, int64_t lateral_moment) {
+      balance_ = true;
+      row_.assign(1, 0);
+      lateral_.assign(1, 0);
+      moment_[0] = row_moment;
+      moment_[1] = lateral_moment;
+    }
+
+    void WindowScorer::push_back(int sc, int id, double cost) {
+      ids_.push_back(id);
+      classes_.push_back(sc);
+      cost_.push_back(cost_.back() + cost);
+      count_.push_back(count_.back());
+      ++count_.back()[sc];
+      taken_.push_back(0);
+    }
+
+    void WindowScorer::push_back(int sc, int id, double cost, int row, int lateral) {
+      push_back(sc, id, cost);
+      row_.push_back(row_.back() + row);
+      lateral_.push_back(lateral_.back() + lateral);
+    }
+
+    template <typename Policy>
+    double WindowScorer::fixed_cost(size_t offset, const Policy& policy) const {
+      const int w = window();
+      if (!w) return 0;
+      return cost_[offset + w] - cost_[offset]
+	+ policy.non_contiguous * (ids_[offset + w - 1] - ids_[offset] - w + 1)
+	+ balance_cost(offset, policy);
+    }
+
+    double WindowScorer::penalty_bound(size_t offset) const {
+      // every passenger pays at least the penalty of the cheapest
+      // seat class present in the window
+      double result = 0;
+      for (int pc = 0; pc < n_passenger_classes; ++pc) {
+	if (!group_[pc]) continue;
+	double best = std::numeric_limits<double>::max();
+	for (int sc = 0; sc < n_seat_classes; ++sc)
+	  if (count(offset, sc) && pen_[pc][sc] < best)
+	    best = pen_[pc][sc];
+	result += group_[pc] * best;
+      }
+      return result;
+    }
+
+    bool WindowScorer::class_penalty(size_t offset, double& result) const {
+      class_count avail;
+      for (int sc = 0; sc < n_seat_classes; ++sc)
+	avail[sc] = count(offset, sc);
+      int seats = window();
+      result = 0;
+      for (int pc = 0; pc < n_passenger_classes && seats; ++pc) {
+	int todo = group_[pc];
+	while (todo && seats) {
+	  // cheapest seat classes left
+	  double best = std::numeric_limits<double>::max();
+	  int tied = 0, total = 0;
+	  for (int sc = 0; sc < n_seat_classes; ++sc) {
+	    if (!avail[sc]) continue;
+	    if (pen_[pc][sc] < best) {
+	      best = pen_[pc][sc];
+	      tied = 1;
+	      total = avail[sc];
+	    }
+	    else if (pen_[pc][sc] == best) {
+	      ++tied;
+	      total += avail[sc];
+	    }
+	  }
+	  int take = std::min(todo, total);
+	  // match() breaks ties by seat order. That is irrelevant if
+	  // the remaining passengers can't tell the tied classes apart.
+	  if (tied > 1 && take < total)
+	    for (int q = pc + 1; q < n_passenger_classes; ++q) {
+	      if (!group_[q]) continue;
+	      int ref = -1;
+	      for (int sc = 0; sc < n_seat_classes; ++sc) {
+		if (!avail[sc] || pen_[pc][sc] != best) continue;
+		if (ref < 0) ref = sc;
+		else if (pen_[q][sc] != pen_[q][ref]) return false;
+	      }
+	    }
+	  result += take * best;
+	  todo -= take;
+	  seats -= take;
+	  for (int sc = 0; sc < n_seat_classes && take; ++sc) {
+	    if (!avail[sc] || pen_[pc][sc] != best) continue;
+	    int n = std::min(take, avail[sc]);
+	    avail[sc] -= n;
+	    take -= n;
+	  }
 	}
-	// mark first and last place in row as window
-	seat_creators[cat].front().set_type(SeatType::kWindow);
-	seat_creators[cat].back().set_type(SeatType::kWindow);
-      }
-      else if (tmp == "center") file >> center_at_[cat];
-      else continue; // ignore unknown commands
-      
-    }
-    size_t id = 0;
-    for (auto const& o : offset_){
-      const TravelCategory& cat = o.first;
-      seats_by_row_[cat].resize(rows_[cat]);
-      for (int i = 0; i < rows_[cat]; ++i){
-	int row_number = i + offset_[cat];
-	// introduce a weight penalty depending on how far off-center
-	// a seat is 
-	double weight = detail::weight_penalty*abs(row_number - center_at_[cat]);
-	// mark exit seats
-	bool is_exit = std::find(emergency_[cat].begin(), 
-				 emergency_[cat].end(), 
-				   row_number) != emergency_[cat].end();
-	// alternate with filling rows left-to-right and
-	// right-to-left to have some basic load balancing
-	if (i % 2)
-	  for (auto creator = seat_creators[cat].begin();
-	       creator != seat_creators[cat].end(); ++creator){
-	    empty_seats_by_id_[cat].push_back(creator->make_seat(i + o.second, 
-								 id++, is_exit, weight));
-	    seats_by_row_[cat][i].push_back(empty_seats_by_id_[cat].back());
+      }
+      return true;
+    }
+
+    double WindowScorer::seat_penalty(size_t offset,
+				      std::vector<unsigned char>& scratch) const {
+      const size_t w = window();
+      scratch.assign(classes_.begin() + offset, classes_.begin() + offset + w);
+      double result = 0;
+      size_t pos = 0;
+      for (int pc = 0; pc < n_passenger_classes; ++pc)
+	for (int k = 0; k < group_[pc] && pos < w; ++k, ++pos) {
+	  // same as find_best_match(): first seat with lowest penalty
+	  size_t j = pos + first_min(&scratch[pos], w - pos, rank_[pc]);
+	  result += pen_[pc][scratch[j]];
+	  std::swap(scratch[j], scratch[pos]);
+	}
+      return result;
+    }
+
+    void WindowScorer::plan(size_t offset, TransportPlan& result) const {
+      class_count avail;
+      for (int sc = 0; sc < n_seat_classes; ++sc)
+	avail[sc] = count(offset, sc);
+      solve_transport(group_, avail, pen_, result);
+    }
+
+    double WindowScorer::passenger_penalty(size_t offset,
+					   std::vector<unsigned char>& scratch) const {
+      double result;
+      if (mode_ == AssignMode::kOptimal) {
+	TransportPlan p;
+	plan(offset, p);
+	result = p.cost;
+      }
+      else if (!class_penalty(offset, result))
+	result = seat_penalty(offset, scratch);
+      return result;
+    }
+
+    double WindowScorer::score(size_t offset) const {
+      return passenger_penalty(offset, scratch_) + fixed_cost(offset, weights_);
+    }
+
+    size_t WindowScorer::best_window() const {
+      // the default weights get the scan with constants folded in
+      if (weights_.is_default())
+	return best_window(DefaultPenalties());
+      return best_window(weights_);
+    }
+
+    template <typename Policy>
+    size_t WindowScorer::best_window(const Policy& policy) const {
+      if (n_taken_ && group_size_)
+	return best_live(policy);
+      const size_t n = size();
+      if (n <= group_size_ || !group_size_)
+	return 0; // only one window, or nobody to seat
+      const size_t end = n - window() + 1;
+      size_t best = 0;
+      double best_score = score(0);
+      ASAP_COUNT(n_windows_, end);
+      ASAP_COUNT(n_penalties_, 1);
+      if (n_threads_ < 2 || end < min_windows_) {
+	best_in(1, end, best, best_score, scratch_, n_penalties_, policy);
+	return best;
+      }
+      // split the windows into one slice per thread, each slice is
+      // searched like the serial loop does, starting from score(0)
+      const size_t n_threads = std::min<size_t>(n_threads_, end - 1);
+      slices_.assign(n_threads, Slice{0, best_score, 0});
+      auto slice = [&](size_t t) {
+	// each thread keeps its scratch for the next call
+	thread_local std::vector<unsigned char> scratch;
+	Slice& s = slices_[t];
+	best_in(1 + (end - 1) * t / n_threads, 1 + (end - 1) * (t + 1) / n_threads,
+		s.best, s.score, scratch, s.n_penalties, policy);
+      };
+      SlicePool::instance().run(n_threads, slice);
+      // slices are in offset order, so a strict test keeps the
+      // lowest offset among equal scores, as the serial loop does
+      for (const Slice& s : slices_) {
+	ASAP_COUNT(n_penalties_, s.n_penalties);
+	if (s.score < best_score) {
+	  best = s.best;
+	  best_score = s.score;
+	}
+      }
+      return best;
+    }
+
+    template <typename Policy>
+    size_t WindowScorer::best_live(const Policy& policy) const {
+      const size_t n = size(), w = window();
+      // one window over the seats left is all compact() would leave
+      if (n - n_taken_ <= group_size_)
+	return n;
+      size_t best = n;
+      double best_score = std::numeric_limits<double>::max();
+      // next seat not taken from i on
+      auto next = [&](size_t i) {
+	while (i < n && taken_[i]) ++i;
+	return i;
+      };
+      bool first_window = true;
+      for (size_t run = next(0); run < n; ) {
+	size_t end = run;
+	while (end < n && !taken_[end]) ++end;
+	ASAP_COUNT(n_windows_, end - run >= w ? end - run - w + 1 : 0);
+	for (size_t first = run; first + w <= end; ++first) {
+	  double new_score = fixed_cost(first, policy);
+	  // the tests best_in() makes, on the seats left; the first
+	  // window of all is scored like score(0)
+	  if (id_neighbors_ && !first_window) {
+	    const size_t after = next(first + w), after2 = next(after + 1);
+	    if (after2 < n && ids_[after2] - 1 != ids_[after])
+	      new_score += policy.neighbor_seat_occupied;
+	    if (first == run || ids_[first - 1] + 1 != ids_[first])
+	      new_score += policy.neighbor_seat_occupied;
 	  }
-	else
-	  for (auto creator = seat_creators[cat].rbegin();
-		 creator != seat_creators[cat].rend(); ++creator){
-	    empty_seats_by_id_[cat].push_back(creator->make_seat(i + o.second,
-								 id++, is_exit, weight));
-	    seats_by_row_[cat][i].push_front(empty_seats_by_id_[cat].back());
+	  first_window = false;
+	  if (new_score + penalty_bound(first) >= best_score)
+	    continue;
+	  const double pen = passenger_penalty(first, scratch_);
+	  ASAP_COUNT(n_penalties_, 1);
+	  if (new_score + pen < best_score) {
+	    best = first;
+	    best_score = new_score + pen;
 	  }
+	}
+	first_window = false;
+	run = next(end);
       }
+      return best;
+    }
+
+    bool WindowScorer::best_in_run(bool left, bool right, size_t& best,
+				   double& best_score) const {
+      if (weights_.is_default())
+	return best_in_run(left, right, best, best_score, DefaultPenalties());
+      return best_in_run(left, right, best, best_score, weights_);
+    }
+
+    template <typename Policy>
+    bool WindowScorer::best_in_run(bool left, bool right, size_t& best,
+				   double& best_score, const Policy& policy) const {
+      const size_t n = size(), w = window();
+      bool found = false;
+      ASAP_COUNT(n_windows_, n - w + 1);
+      for (size_t first = 0; first + w <= n; ++first) {
+	// no gaps within a run, and the neighbours are known exactly
+	double new_score = cost_[first + w] - cost_[first] + balance_cost(first, policy);
+	if (id_neighbors_ && left && first == 0)
+	  new_score += policy.neighbor_seat_occupied;
+	if (id_neighbors_ && right && first + w == n)
+	  new_score += policy.neighbor_seat_occupied;
+	if (new_score + penalty_bound(first) >= best_score)
+	  continue;
+	const double pen = passenger_penalty(first, scratch_);
+	ASAP_COUNT(n_penalties_, 1);
+	if (new_score + pen < best_score) {
+	  best = first;
+	  best_score = new_score + pen;
+	  found = true;
+	}
+      }
+      return found;
+    }
+
+    template <typename Policy>
+    void WindowScorer::best_in(size_t first, size_t end, size_t& best,
+			       double& best_score, std::vector<unsigned char>& scratch,
+			       [[maybe_unused]] uint64_t& n_penalties,
+			       const Policy& policy) const {
+      const size_t n = size(), w = window();
+      for (; first < end; ++first) {
+	const size_t last = first + w;
+	double new_score = fixed_cost(first, policy);
+	// additional penalty for sitting directly next to a
+	// passenger from another group, using the same tests as
+	// Flight::checkin always did
+	if (id_neighbors_) {
+	  if (last + 1 < n && ids_[last + 1] - 1 != ids_[last])
+	    new_score += policy.neighbor_seat_occupied;
+	  if (ids_[first - 1] + 1 != ids_[first])
+	    new_score += policy.neighbor_seat_occupied;
+	}
+	// cheap test first, most windows can't win anyway
+	if (new_score + penalty_bound(first) >= best_score)
+	  continue;
+	const double pen = passenger_penalty(first, scratch);
+	ASAP_COUNT(n_penalties, 1);
+	if (new_score + pen < best_score){
+	  best = first;
+	  best_score = new_score + pen;
+	}
+      }
+    }
+
+    void WindowScorer::assign(size_t offset, std::vector<int>& seat_of) const {
+      const size_t w = window();
+      seat_of.assign(group_size_, -1);
+      // seats still to be taken, in the order assign() would see them
+      order_.resize(w);
+      for (size_t j = 0; j < w; ++j)
+	order_[j] = offset + j;
+      TransportPlan p;
+      if (mode_ == AssignMode::kOptimal)
+	plan(offset, p);
+      size_t pos = 0, k = 0;
+      for (int pc = 0; pc < n_passenger_classes; ++pc)
+	for (int i = 0; i < group_[pc]; ++i, ++k) {
+	  size_t j = pos;
+	  if (mode_ == AssignMode::kOptimal) {
+	    // first seat of a class the plan routes this class to
+	    while (j < w && !p.flow[pc][classes_[order_[j]]]) ++j;
+	    if (j == w) continue;
+	    --p.flow[pc][classes_[order_[j]]];
+	  }
+	  else {
+	    // first seat with lowest penalty, like find_best_match()
+	    if (pos == w) continue;
+	    for (size_t l = pos + 1; l < w; ++l)
+	      if (pen_[pc][classes_[order_[l]]] < pen_[pc][classes_[order_[j]]])
+		j = l;
+	  }
+	  seat_of[k] = order_[j];
+	  std::swap(order_[j], order_[pos]);
+	  ++pos;
+	}
     }
-  } // Flight::init
 
-  void Flight::show() {
-    std::cout << "FLIGHT " << flight_number_ << std::endl;
-    for (auto rows : seats_by_row_){
-      // print category
-      std::cout << "---------  " 
-		<< detail::CatMap::instance().desc(rows.first) 
-		<< "  ---------"
-		<< std::endl;
-      for (int row = 0; row < rows.second.size(); ++row){
-	std::cout << row + offset_[rows.first] << ": ";
-	for (auto seat : rows.second[row]){
-	  std::cout << seat->get_info() << "::";
-	  if (seat->get_passenger())
-	    std::cout << seat->get_passenger()->get_name();
-	  else
-	    std::cout << "----";
-	  std::cout << ", ";
+    void WindowScorer::erase(size_t offset, size_t n) {
+      const double cost = cost_[offset + n] - cost_[offset];
+      class_count counts;
+      for (int sc = 0; sc < n_seat_classes; ++sc)
+	counts[sc] = count_[offset + n][sc] - count_[offset][sc];
+      ids_.erase(ids_.begin() + offset, ids_.begin() + offset + n);
+      classes_.erase(classes_.begin() + offset, classes_.begin() + offset + n);
+      taken_.erase(taken_.begin() + offset, taken_.begin() + offset + n);
+      cost_.erase(cost_.begin() + offset + 1, cost_.begin() + offset + n + 1);
+      count_.erase(count_.begin() + offset + 1, count_.begin() + offset + n + 1);
+      for (size_t i = offset + 1; i < cost_.size(); ++i) {
+	cost_[i] -= cost;
+	for (int sc = 0; sc < n_seat_classes; ++sc)
+	  count_[i][sc] -= counts[sc];
+      }
+      if (!balance_)
+	return;
+      // the seats erased are taken now
+      const int64_t moment[2] = {row_[offset + n] - row_[offset],
+				 lateral_[offset + n] - lateral_[offset]};
+      moment_[0] += moment[0];
+      moment_[1] += moment[1];
+      row_.erase(row_.begin() + offset + 1, row_.begin() + offset + n + 1);
+      lateral_.erase(lateral_.begin() + offset + 1, lateral_.begin() + offset + n + 1);
+      for (size_t i = offset + 1; i < row_.size(); ++i) {
+	row_[i] -= moment[0];
+	lateral_[i] -= moment[1];
+      }
+    }
+
+    void WindowScorer::take(size_t offset, size_t n) {
+      std::fill(taken_.begin() + offset, taken_.begin() + offset + n, 1);
+      n_taken_ += n;
+      if (!balance_)
+	return;
+      moment_[0] += row_[offset + n] - row_[offset];
+      moment_[1] += lateral_[offset + n] - lateral_[offset];
+    }
+
+    void WindowScorer::compact() {
+      if (!n_taken_)
+	return;
+      // rebuild the prefix sums over the seats left, reading each
+      // entry before it can be overwritten
+      size_t k = 0;
+      double cost = cost_[0];
+      int64_t row = balance_ ? row_[0] : 0, lateral = balance_ ? lateral_[0] : 0;
+      for (size_t i = 0; i < ids_.size(); ++i) {
+	const double next_cost = cost_[i + 1];
+	const int64_t next_row = balance_ ? row_[i + 1] : 0;
+	const int64_t next_lateral = balance_ ? lateral_[i + 1] : 0;
+	if (!taken_[i]) {
+	  ids_[k] = ids_[i];
+	  classes_[k] = classes_[i];
+	  cost_[k + 1] = cost_[k] + (next_cost - cost);
+	  count_[k + 1] = count_[k];
+	  ++count_[k + 1][classes_[k]];
+	  if (balance_) {
+	    row_[k + 1] = row_[k] + (next_row - row);
+	    lateral_[k + 1] = lateral_[k] + (next_lateral - lateral);
+	  }
+	  ++k;
 	}
-	std::cout << std::endl;
+	cost = next_cost;
+	row = next_row;
+	lateral = next_lateral;
       }
+      ids_.resize(k);
+      classes_.resize(k);
+      cost_.resize(k + 1);
+      count_.resize(k + 1);
+      if (balance_) {
+	row_.resize(k + 1);
+	lateral_.resize(k + 1);
+      }
+      taken_.assign(k, 0);
+      n_taken_ = 0;
     }
-  } // Flight::show
+
+    SeatMap::SeatMap(const SeatMap& other)
+      : cabins_(other.cabins_), row_cabin_(other.row_cabin_),
+	columns_(other.columns_), class_(other.class_), dist_(other.dist_),
+	size_(other.size_), own_class_(other.own_class_),
+	own_dist_(other.own_dist_), image_(other.image_),
+	adj_first_(other.adj_first_), adj_(other.adj_),
+	own_adj_first_(other.own_adj_first_), own_adj_(other.own_adj_) {
+      if (!image_)
+	own();
+    }
+
+    SeatMap& SeatMap::operator=(const SeatMap& other) {
+      if (this != &other) {
+	SeatMap tmp(other);
+	*this = std::move(tmp);
+      }
+      return *this;
+    }
+
+    void SeatMap::own() {
+      class_ = own_class_.data();
+      dist_ = own_dist_.data();
+      size_ = own_class_.size();
+      adj_first_ = own_adj_first_.data();
+      adj_ = own_adj_.data();
+    }
+
+    void SeatMap::add_cabin(Cabin c) {
+      if (image_) {
+	// copy the seats out of the image before adding to them
+	own_class_.assign(class_, class_ + size_);
+	own_dist_.assign(dist_, dist_ + size_);
+	own_adj_first_.assign(adj_first_, adj_first_ + size_ + 1);
+	own_adj_.assign(adj_, adj_ + adj_first_[size_]);
+	image_.reset();
+      }
+      c.first_seat = size();
+      for (int i = 0; i < c.rows; ++i) {
+	const int row_number = c.first_row + i;
+	// mark exit seats
+	const bool is_exit = c.is_exit_row(row_number);
+	// introduce a weight penalty depending on how far off-center
+	// a seat is
+	const unsigned short dist = std::abs(row_number - c.center);
+	for (int k = 0; k < c.row_size(); ++k) {
+	  const int col = i % 2 ? k : c.row_size() - 1 - k;
+	  own_class_.push_back(detail::seat_class(c.types[col], is_exit));
+	  own_dist_.push_back(dist);
+	}
+      }
+      index(c, cabins_.size());
+      link(c);
+      own();
+      cabins_.push_back(std::move(c));
+    }
+
+    namespace {
+      // call op(id, kind) for the neighbours of the seat at row index
+      // i and column col of a cabin
+      template <typename Op>
+      void each_adjacent(const SeatMap& seats, const SeatMap::Cabin& c,
+			 int i, int col, Op op) {
+	auto group = [&c](int col) { return c.groups.empty() ? 0 : c.groups[col]; };
+	for (int k : {col - 1, col + 1})
+	  if (k >= 0 && k < c.row_size())
+	    op(seats.at(c, i, k), group(k) == group(col) ? Neighbor::kSameRow
+	       : Neighbor::kAcrossAisle);
+	for (int r : {i - 1, i + 1})
+	  if (r >= 0 && r < c.rows)
+	    op(seats.at(c, r, col), Neighbor::kFrontBack);
+      }
+    }
+
+    void SeatMap::index(const Cabin& c, int index) {
+      if (row_cabin_.size() < static_cast<size_t>(c.first_row + c.rows))
+	row_cabin_.resize(c.first_row + c.rows, -1);
+      std::fill(row_cabin_.begin() + c.first_row,
+		row_cabin_.begin() + c.first_row + c.rows, index);
+      for (int col = 0; col < c.row_size(); ++col) {
+	const std::string& l = c.labels[col];
+	columns_[key(index, l.data(), l.data() + l.size())] = col;
+      }
+    }
+
+    void SeatMap::link(const Cabin& c) {
+      // in two passes to size the table once
+      if (own_adj_first_.empty())
+	own_adj_first_.push_back(0);
+      const size_t first = own_adj_first_.size();
+      own_adj_first_.resize(first + c.seats());
+      for (int i = 0; i < c.rows; ++i)
+	for (int col = 0; col < c.row_size(); ++col) {
+	  uint32_t n = 0;
+	  each_adjacent(*this, c, i, col, [&n](int, Neighbor) { ++n; });
+	  own_adj_first_[1 + at(c, i, col)] = n;
+	}
+      for (size_t id = first; id < own_adj_first_.size(); ++id)
+	own_adj_first_[id] += own_adj_first_[id - 1];
+      own_adj_.resize(own_adj_first_.back());
+      for (int i = 0; i < c.rows; ++i)
+	for (int col = 0; col < c.row_size(); ++col) {
+	  uint32_t pos = own_adj_first_[at(c, i, col)];
+	  each_adjacent(*this, c, i, col, [&](int id, Neighbor kind) {
+	      own_adj_[pos++] = uint32_t(id) << 2 | static_cast<uint32_t>(kind); });
+	}
+    }
+
+    uint64_t SeatMap::key(int cabin, const char* first, const char* last) {
+      if (first == last || last - first > 7)
+	return 0;
+      uint64_t result = uint64_t(cabin + 1) << 56;
+      for (int shift = 0; first != last; ++first, shift += 8)
+	result |= uint64_t(static_cast<unsigned char>(*first)) << shift;
+      return result;
+    }
+
+    int SeatMap::find(const std::string& label) const {
+      // split into row number and label within the row
+      const char* first = label.data();
+      const char* last = first + label.size();
+      int row = 0;
+      for (; first != last && std::isdigit(static_cast<unsigned char>(*first))
+	     && row < 100000; ++first)
+	row = 10*row + (*first - '0');
+      if (first == label.data() || row >= static_cast<int>(row_cabin_.size())
+	  || row_cabin_[row] < 0)
+	return -1;
+      const int cabin = row_cabin_[row];
+      auto col = columns_.find(key(cabin, first, last));
+      if (col == columns_.end())
+	return -1;
+      return at(cabins_[cabin], row - cabins_[cabin].first_row, col->second);
+    }
+
+    const SeatMap::Cabin* SeatMap::cabin(const TravelCategory& cat) const {
+      for (const auto& c : cabins_)
+	if (c.cat == cat)
+	  return &c;
+      return 0;
+    }
+
+    const SeatMap::Cabin& SeatMap::cabin_of(int id) const {
+      auto c = cabins_.begin();
+      while (id >= c->first_seat + c->seats())
+	++c;
+      return *c;
+    }
+
+    int SeatMap::row(int id) const {
+      const Cabin& c = cabin_of(id);
+      return c.first_row + (id - c.first_seat) / c.row_size();
+    }
+
+    int SeatMap::column(int id) const {
+      const Cabin& c = cabin_of(id);
+      const int i = (id - c.first_seat) / c.row_size();
+      const int k = (id - c.first_seat) % c.row_size();
+      return i % 2 ? k : c.row_size() - 1 - k;
+    }
+
+    PassengerArena::Handle PassengerArena::add(std::string_view name, SeatType type,
+					       bool minor) {
+      passengers_.push_back({intern(name), static_cast<uint8_t>(type), minor});
+      return passengers_.size() - 1;
+    }
+
+    uint32_t PassengerArena::intern(std::string_view name) {
+      if (names_.empty())
+	names_.push_back(0);
+      // keep the table at most half full
+      if (2 * (n_names_ + 1) > slots_.size()) {
+	std::vector<uint32_t> old(std::max<size_t>(16, 2 * slots_.size()), 0);
+	old.swap(slots_);
+	for (uint32_t n = 0; n < n_names_; ++n) {
+	  const std::string_view s(pool_.data() + names_[n], names_[n + 1] - names_[n]);
+	  size_t i = std::hash<std::string_view>()(s) & (slots_.size() - 1);
+	  while (slots_[i]) i = (i + 1) & (slots_.size() - 1);
+	  slots_[i] = n + 1;
+	}
+      }
+      size_t i = std::hash<std::string_view>()(name) & (slots_.size() - 1);
+      for (; slots_[i]; i = (i + 1) & (slots_.size() - 1)) {
+	const uint32_t n = slots_[i] - 1;
+	if (name == std::string_view(pool_.data() + names_[n], names_[n + 1] - names_[n]))
+	  return n;
+      }
+      pool_.insert(pool_.end(), name.begin(), name.end());
+      names_.push_back(pool_.size());
+      slots_[i] = n_names_ + 1;
+      return n_names_++;
+    }
+  } // namespace detail
   
-  Flight::Flight(std::string file) {
-    std::ifstream input_file(file);
-    if (!input_file.is_open())
-      throw FileNotFoundError();
-    std::string tmp;
-    detail::get_lower(input_file, tmp);
-    if (tmp != "flight")
-      throw InputFileFormatError();
-    input_file >> flight_number_;
-    init(input_file);
+  std::shared_ptr<const AircraftLayout> AircraftLayout::load(const std::string& file) {
+    std::shared_ptr<AircraftLayout> result(new AircraftLayout);
+    // the parser works in place on the mapped file, an image is used
+    // in place for as long as the layout lives
+    auto input = std::make_shared<const detail::MappedFile>(file);
+    if (detail::is_layout_image(input->data(), input->size()))
+      detail::load_layout_image(input, result->seats_, result->flight_number_,
+				result->penalties_);
+    else {
+      detail::Layout layout;
+      detail::parse_layout(std::string_view(input->data(), input->size()), layout);
+      result->flight_number_ = std::move(layout.flight_number);
+      result->penalties_ = layout.penalties;
+      for (auto& c : layout.cabins)
+	result->seats_.add_cabin(std::move(c));
+    }
+    return result;
+  } // AircraftLayout::load
+
+  namespace detail {
+    void FreeRuns::clear(size_t n) {
+      end_.assign(n, 0);
+      next_.assign(n, -1);
+      prev_.assign(n, -1);
+      for (auto& h : head_)
+	h.fill(-1);
+    }
+
+    void FreeRuns::link(int k, int first, int last) {
+      int& head = head_[k][31 - __builtin_clz(last - first)];
+      end_[first] = last;
+      prev_[first] = -1;
+      next_[first] = head;
+      if (head >= 0)
+	prev_[head] = first;
+      head = first;
+    }
+
+    void FreeRuns::unlink(int k, int first) {
+      if (prev_[first] >= 0)
+	next_[prev_[first]] = next_[first];
+      else
+	head_[k][31 - __builtin_clz(end_[first] - first)] = next_[first];
+      if (next_[first] >= 0)
+	prev_[next_[first]] = prev_[first];
+    }
+
+    void FreeRuns::add(int k, const Bitmap& taken, int first, int last) {
+      while (first < last) {
+	const int run = taken.next_set(first, last);
+	if (run > first)
+	  link(k, first, run);
+	first = run + 1;
+      }
+    }
+
+    void FreeRuns::update(int k, const Bitmap& taken, int id, int first, int last) {
+      // the runs left and right of id, which are one if id is clear
+      const int a = taken.prev_set_end(first, id);
+      const int b = taken.next_set(id + 1, last);
+      if (taken.test(id)) {
+	unlink(k, a);
+	if (a < id)
+	  link(k, a, id);
+	if (id + 1 < b)
+	  link(k, id + 1, b);
+      }
+      else {
+	if (a < id)
+	  unlink(k, a);
+	if (id + 1 < b)
+	  unlink(k, id + 1);
+	link(k, a, b);
+      }
+    }
+  } // namespace detail
+
+#ifndef ASAP_NO_STATS
+  class Flight::OpTimer {
+  public:
+    OpTimer(Flight& f, Stats::Op op)
+      : f_(f), op_(op), before_(f.counters()),
+	timed_(f.stats_.ops[op]++ % Stats::sample_every == 0) {
+      if (timed_)
+	start_ = std::chrono::steady_clock::now();
+    }
+    ~OpTimer() {
+      uint64_t ns = 0;
+      if (timed_) {
+	ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	  std::chrono::steady_clock::now() - start_).count();
+	f_.stats_.latency[op_].add(ns);
+      }
+      StatsRegistry::instance().record(op_, timed_, ns, f_.counters() - before_);
+    }
+  private:
+    Flight& f_;
+    const Stats::Op op_;
+    const Stats::Counters before_;
+    const bool timed_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  Stats::Counters Flight::counters() const {
+    Stats::Counters result = stats_.counters;
+    result.windows = scorer_.n_windows();
+    result.penalties = scorer_.n_penalties();
+    return result;
+  }
+
+  Stats Flight::stats() const {
+    Stats result = stats_;
+    result.counters = counters();
+    return result;
+  }
+#else
+  class Flight::OpTimer {
+  public:
+    OpTimer(Flight&, Stats::Op) { }
+  };
+
+  Stats Flight::stats() const {
+    return Stats();
+  }
+#endif
+
+  Seat Flight::seat(int id) const {
+    seat_id(id);
+    Seat result(seats_->type(id), id, seats_->label(id),
+		penalties_.weight * seats_->dist(id), seats_->is_exit(id));
+    if (!occupied_.test(id))
+      return result;
+    const unsigned h = occupants_[id].handle;
+    if (use_arena_)
+      result.set_passenger(std::make_shared<Passenger>(std::string(arena_.name(h)),
+						       arena_.type(h), arena_.is_minor(h)));
+    else
+      result.set_passenger(passengers_[h]);
+    return result;
+  }
+  
+  Flight::Flight(std::string file)
+    : placement_(PlacementMode::kScan), seats_(0), use_arena_(false), next_group_(1),
+      neighbor_mode_(NeighborMode::kIds), assign_mode_(AssignMode::kGreedy) {
+    OpTimer timer(*this, Stats::kLoad);
+    init(AircraftLayout::load(file), std::string());
+    // loading costs O(seats) anyway, so the flight takes its tables
+    // in one go, and check-in never grows them
+    occupants_.reserve();
+    passengers_.reserve(seats_->size());
+  }
+
+  Flight::Flight(std::shared_ptr<const AircraftLayout> layout, std::string flight_number)
+    : placement_(PlacementMode::kScan), seats_(0), use_arena_(false), next_group_(1),
+      neighbor_mode_(NeighborMode::kIds), assign_mode_(AssignMode::kGreedy) {
+    init(std::move(layout), std::move(flight_number));
+  }
+
+  void Flight::init(std::shared_ptr<const AircraftLayout> layout, std::string flight_number) {
+    layout_ = std::move(layout);
+    seats_ = &layout_->seats();
+    flight_number_ = flight_number.empty() ? layout_->flight_number() : std::move(flight_number);
+    penalties_ = layout_->penalties();
+    scorer_.set_policy(penalties_);
+    occupied_.resize(seats_->size());
+    occupants_.assign(seats_->size());
+    // check-ins of groups up to this size don't allocate for it
+    last_seats_.reserve(16);
+    n_empty_.fill(0);
+    for (const auto& c : seats_->cabins())
+      n_empty_[static_cast<int>(c.cat)] = c.seats();
+  } // Flight::init
+
+  void Flight::set_penalties(const detail::PenaltyWeights& penalties) {
+    penalties_ = penalties;
+    scorer_.set_policy(penalties_);
+  }
+
+  void Flight::set_placement_mode(PlacementMode mode) {
+    if (mode == PlacementMode::kRuns && placement_ != mode) {
+      runs_.clear(seats_->size());
+      for (const auto& c : seats_->cabins())
+	runs_.add(static_cast<int>(c.cat), occupied_, c.first_seat,
+		  c.first_seat + c.seats());
+    }
+    placement_ = mode;
+  }
+
+  void Flight::set_arena(bool on) {
+    if (on == use_arena_)
+      return;
+    detail::PassengerArena arena;
+    std::vector<std::shared_ptr<Passenger> > passengers;
+    if (on)
+      arena.reserve(seats_->size());
+    else
+      passengers.reserve(seats_->size());
+    for (int id = 0; id < seats_->size(); ++id) {
+      if (!occupied_.test(id))
+	continue;
+      unsigned& h = occupants_[id].handle;
+      if (on) {
+	const Passenger& p = *passengers_[h];
+	h = arena.add(p.get_name(), p.get_seat_type(), p.is_minor());
+      }
+      else {
+	passengers.push_back(std::make_shared<Passenger>(std::string(arena_.name(h)),
+							 arena_.type(h), arena_.is_minor(h)));
+	h = passengers.size() - 1;
+      }
+    }
+    arena_ = std::move(arena);
+    passengers_.swap(passengers);
+    free_.clear();
+    use_arena_ = on;
+  }
+
+  void Flight::occupy(int id, const std::shared_ptr<Passenger>& p) {
+    unsigned& h = occupants_[id].handle;
+    if (use_arena_)
+      h = arena_.add(p->get_name(), p->get_seat_type(), p->is_minor());
+    else if (free_.empty()) {
+      h = passengers_.size();
+      passengers_.push_back(p);
+    }
+    else {
+      h = free_.back();
+      free_.pop_back();
+      passengers_[h] = p;
+    }
+    mark_taken(id);
+  }
+
+  void Flight::occupy(int id, Passenger* p) {
+    if (!use_arena_)
+      return occupy(id, std::make_shared<Passenger>(std::move(*p)));
+    occupants_[id].handle = arena_.add(p->get_name(), p->get_seat_type(), p->is_minor());
+    mark_taken(id);
+  }
+
+  void Flight::mark_taken(int id) {
+    occupied_.set(id);
+    occupants_[id].group = 0;
+    const detail::SeatMap::Cabin& c = seats_->cabin_of(id);
+    --n_empty_[static_cast<int>(c.cat)];
+    balance_[static_cast<int>(c.cat)].add(seats_->row(id), seats_->lateral(id));
+    if (placement_ == PlacementMode::kRuns)
+      runs_.update(static_cast<int>(c.cat), occupied_, id, c.first_seat,
+		   c.first_seat + c.seats());
+    if (journal_.get())
+      journal_seat(id);
+  }
+
+  void Flight::vacate(int id) {
+    occupied_.reset(id);
+    const detail::SeatMap::Cabin& c = seats_->cabin_of(id);
+    ++n_empty_[static_cast<int>(c.cat)];
+    balance_[static_cast<int>(c.cat)].remove(seats_->row(id), seats_->lateral(id));
+    if (placement_ == PlacementMode::kRuns)
+      runs_.update(static_cast<int>(c.cat), occupied_, id, c.first_seat,
+		   c.first_seat + c.seats());
+    if (journal_.get())
+      journal_vacate(id);
+  }
+
+  void Flight::release(int id) {
+    // an arena keeps the passenger, until the flight goes
+    if (use_arena_)
+      return;
+    const unsigned h = occupants_[id].handle;
+    passengers_[h].reset();
+    free_.push_back(h);
+  }
+
+  int Flight::occupied_neighbors(int id, Neighbor kind) const {
+    int result = 0;
+    seats_->each_neighbor(seat_id(id), [this, kind, &result](int j, Neighbor k) {
+	result += k == kind && occupied_.test(j); });
+    return result;
   }
 
   void PassengerGroup::sort() {
     detail::sort_most_restrictive_first(begin(), end());
   };
-  Flight::AssignResult Flight::checkin(PassengerGroup& g){
+  double Flight::seat_cost(int id) const {
+    double result = penalties_.weight * seats_->dist(id);
+    // with NeighborMode::kSeats, a seat costs its occupied neighbours
+    if (neighbor_mode_ == NeighborMode::kSeats)
+      seats_->each_neighbor(id, [this, &result](int j, Neighbor kind) {
+	  if (occupied_.test(j))
+	    result += penalties_.neighbor(kind);
+	});
+    return result;
+  }
+
+  LoadBalance Flight::balance() const {
+    LoadBalance result;
+    for (const auto& b : balance_)
+      result += b;
+    return result;
+  }
+
+  void Flight::set_scorer_balance(const detail::SeatMap::Cabin& c) {
+    // rows relative to the center row, as push_seat pushes them
+    const LoadBalance& b = balance_[static_cast<int>(c.cat)];
+    scorer_.set_balance(b.row_sum - int64_t(b.passengers) * c.center, b.lateral_sum);
+  }
+
+  void Flight::push_seat(const detail::SeatMap::Cabin& c, int id) {
+    if (penalties_.balance)
+      scorer_.push_back(seats_->seat_class(id), id, seat_cost(id),
+			seats_->row(id) - c.center, seats_->lateral(id));
+    else
+      scorer_.push_back(seats_->seat_class(id), id, seat_cost(id));
+  }
+
+  void Flight::fill_scorer(TravelCategory cat) {
+    scorer_.clear();
+    if (const detail::SeatMap::Cabin* c = seats_->cabin(cat)) {
+      if (penalties_.balance)
+	set_scorer_balance(*c);
+      occupied_.each_clear(c->first_seat, c->first_seat + c->seats(),
+			   [this, c](int id){ push_seat(*c, id); });
+    }
+    scorer_.set_mode(assign_mode_);
+    scorer_.set_id_neighbors(neighbor_mode_ == NeighborMode::kIds);
+  }
+
+  void Flight::fill_scorer(int first, int last) {
+    scorer_.clear();
+    const detail::SeatMap::Cabin& c = seats_->cabin_of(first);
+    if (penalties_.balance)
+      set_scorer_balance(c);
+    for (int id = first; id < last; ++id)
+      push_seat(c, id);
+    scorer_.set_mode(assign_mode_);
+    scorer_.set_id_neighbors(neighbor_mode_ == NeighborMode::kIds);
+  }
+
+  template <typename Iter>
+  bool Flight::take_run(TravelCategory cat, Iter firstp, Iter lastp) {
+    const detail::SeatMap::Cabin* c = seats_->cabin(cat);
+    const int n = lastp - firstp;
+    if (!c || !n)
+      return false;
+    candidates_.clear();
+    runs_.each(static_cast<int>(cat), n, [this](int first, int last) {
+	candidates_.emplace_back(first, last); });
+    if (candidates_.empty())
+      return false;
+    // in id order, so that ties go to the lowest id, as with kScan
+    std::sort(candidates_.begin(), candidates_.end());
+    const int lo = c->first_seat, hi = lo + c->seats();
+    size_t best_run = 0, offset = 0;
+    double best_score = std::numeric_limits<double>::infinity();
+    for (size_t r = 0; r < candidates_.size(); ++r) {
+      fill_scorer(candidates_[r].first, candidates_[r].second);
+      scorer_.set_group(firstp, lastp);
+      if (scorer_.best_in_run(candidates_[r].first > lo, candidates_[r].second < hi,
+			      offset, best_score))
+	best_run = r;
+    }
+    // offset is that of the last improvement, in best_run
+    fill_scorer(candidates_[best_run].first, candidates_[best_run].second);
+    scorer_.set_group(firstp, lastp);
+    take_window(firstp, lastp, offset);
+    return true;
+  }
+
+  template <typename Iter>
+  size_t Flight::take_window(Iter firstp, Iter lastp){
+    scorer_.set_group(firstp, lastp);
+    const size_t offset = scorer_.best_window();
+    take_window(firstp, lastp, offset);
+    return offset;
+  }
+
+  template <typename Iter>
+  void Flight::take_window(Iter firstp, Iter lastp, size_t offset){
+#ifdef DEBUG
+    std::cout << "Assigned with score " << scorer_.score(offset) << std::endl;
+#endif
+    scorer_.assign(offset, seat_of_);
+    ASAP_COUNT(stats_.counters.matches, 1);
+    for (auto seat = seat_of_.begin(); firstp != lastp; ++firstp, ++seat){
+      if (*seat < 0) { // overbooked
+	last_seats_.push_back(-1);
+	continue;
+      }
+      const int id = scorer_.id(*seat);
+      last_seats_.push_back(id);
+#ifdef DEBUG
+      std::cout << "(" << (*firstp)->get_name() << ","
+		<< detail::CatMap::instance().desc((*firstp)->get_seat_type()) 
+		<< "," << (*firstp)->is_minor() << ") -> "
+		<< this->seat(id).get_info() << std::endl;
+#endif
+      occupy(id, *firstp);
+      occupants_[id].group = next_group_;
+    }
+    ++next_group_;
+  }
+
+  template <typename Iter>
+  Flight::AssignResult Flight::place(TravelCategory cat, Iter firstp, Iter lastp){
     AssignResult result = AssignResult::kOk;
-    const TravelCategory& cat = g.cat(); // shorthand
-    g.sort();
-    // another shorthand
-    std::vector<std::shared_ptr<Seat> >& empty_seats = empty_seats_by_id_[cat];
     // report overbooking
-    if (empty_seats.size() < g.size())
+    if (n_empty_[static_cast<int>(cat)] < lastp - firstp) {
       result = AssignResult::kOverbooked;
+      ASAP_COUNT(stats_.counters.overbooked, 1);
+    }
+    if (placement_ == PlacementMode::kRuns && take_run(cat, firstp, lastp))
+      return result;
     // find best set of empty seats
-    auto first = empty_seats.begin();
-    auto last = empty_seats.begin() + std::min(g.size(), empty_seats.size());
-    std::deque<std::shared_ptr<Seat> > best_so_far(first, last); // reminer: assings [first, last)
-    std::deque<std::shared_ptr<Seat> > current = best_so_far;
-    double best_score = detail::match(g.begin(), g.end(), current.begin(), current.end());
-    while (last != empty_seats.end()){
-      current.assign(++first, ++last);
-      double new_score = detail::match(g.begin(), g.end(), current.begin(), current.end());
-      // additional penalty for sitting directly next 
-      // to a passenger from another group
-      // TODO: By looking at occupied seats one could find the min
-      //       distance to an occupied seat and do something more
-      //       sophisticated here
-      if ((last+1) != empty_seats.end() && last != empty_seats.end())
-	if ((*(last+1))->get_id() - 1 != (*last)->get_id())
-	  new_score += detail::neighbor_seat_occupied_penalty;
-      if (first != empty_seats.begin())
-	if ((*(first-1))->get_id() + 1 != (*first)->get_id())
-	  new_score += detail::neighbor_seat_occupied_penalty;
-      if (new_score < best_score){
-	best_so_far.assign(first, last);
-	best_score = new_score;
-      }
-    }
-    detail::assign(g.begin(), g.end(), best_so_far.begin(), best_so_far.end());
-    // safely remove occupied seats from vector
-    empty_seats.erase(std::remove_if(empty_seats.begin(),
-				     empty_seats.end(),
-				     [](const std::shared_ptr<Seat>& s){
-				       return s->get_passenger(); }),
-		      empty_seats.end());
-#ifdef DEBUG
-    std::cout << "Assigned with score " << best_score << std::endl;
-#endif
+    fill_scorer(cat);
+    take_window(firstp, lastp);
+    return result;
+  }
+
+  Flight::AssignResult Flight::checkin(PassengerGroup& g){
+    OpTimer timer(*this, Stats::kCheckinGroup);
+    last_seats_.clear();
+    g.sort();
+    const AssignResult result = place(g.cat(), g.begin(), g.end());
+    journal_commit();
     return result;
   }
+
+  std::vector<Flight::AssignResult> Flight::checkin_batch(PassengerGroup* groups,
+							 size_t n, bool as_given) {
+    OpTimer timer(*this, Stats::kCheckinBatch);
+    std::vector<AssignResult> result(n, AssignResult::kOk);
+    // largest groups first, then those with most minors, then those
+    // with most preferences; each category on its own all the same
+    std::vector<std::array<int, 5> > order(n);
+    for (size_t i = 0; i < n; ++i) {
+      PassengerGroup& g = groups[i];
+      g.sort();
+      int minors = 0, picky = 0;
+      for (const auto& p : g) {
+	minors += p->is_minor();
+	picky += p->get_seat_type() != SeatType::kOther;
+      }
+      if (as_given)
+	order[i] = {static_cast<int>(g.cat()), 0, 0, 0, static_cast<int>(i)};
+      else
+	order[i] = {static_cast<int>(g.cat()), -static_cast<int>(g.size()),
+		    -minors, -picky, static_cast<int>(i)};
+    }
+    std::sort(order.begin(), order.end());
+    last_seats_.clear();
+    // where the seats of each group start in last_seats_
+    std::vector<size_t> first(n);
+    if (placement_ == PlacementMode::kRuns || neighbor_mode_ == NeighborMode::kSeats) {
+      // the index is up to date after each group anyway, and each
+      // group changes the neighbour costs of the seats around it
+      for (const auto& i : order) {
+	PassengerGroup& g = groups[i[4]];
+	first[i[4]] = last_seats_.size();
+	result[i[4]] = place(g.cat(), g.begin(), g.end());
+      }
+    }
+    else {
+      // one pass over the empty seats of each category, the seats
+      // taken by a group are only marked in the scorer, and dropped
+      // when no window is left clear of them
+      for (auto i = order.begin(); i != order.end(); ) {
+	const TravelCategory cat = static_cast<TravelCategory>((*i)[0]);
+	fill_scorer(cat);
+	for (; i != order.end() && (*i)[0] == static_cast<int>(cat); ++i) {
+	  PassengerGroup& g = groups[(*i)[4]];
+	  if (n_empty_[static_cast<int>(cat)] < static_cast<int>(g.size())) {
+	    result[(*i)[4]] = AssignResult::kOverbooked;
+	    ASAP_COUNT(stats_.counters.overbooked, 1);
+	  }
+	  first[(*i)[4]] = last_seats_.size();
+	  scorer_.set_group(g.begin(), g.end());
+	  size_t offset = scorer_.best_window();
+	  if (offset == scorer_.size()) {
+	    scorer_.compact();
+	    offset = scorer_.best_window();
+	  }
+	  take_window(g.begin(), g.end(), offset);
+	  scorer_.take(offset, scorer_.window());
+	}
+      }
+    }
+    // the seats of the groups in the order given
+    std::vector<int> seats;
+    seats.reserve(last_seats_.size());
+    for (size_t i = 0; i < n; ++i)
+      seats.insert(seats.end(), last_seats_.begin() + first[i],
+		   last_seats_.begin() + first[i] + groups[i].size());
+    last_seats_.swap(seats);
+    journal_commit();
+    return result;
+  }
+
   Flight::AssignResult Flight::checkin(TravelCategory cat, const std::string& name,
 				       SeatType seat, bool is_minor) {
-    PassengerGroup g(cat);
-    g.push(name, seat, is_minor);
-    return checkin(g);
+    OpTimer timer(*this, Stats::kCheckinPassenger);
+    last_seats_.clear();
+    // copied to the heap or into the arena once seated
+    Passenger p(name, seat, is_minor);
+    Passenger* q = &p;
+    const AssignResult result = place(cat, &q, &q + 1);
+    journal_commit();
+    return result;
   }
 
   Flight::AssignResult Flight::checkin(TravelCategory cat, const std::string& name,
 				       bool is_minor, const std::string& seat_no){
-    // shorthand
-    const std::vector<std::shared_ptr<Seat> >& seats = empty_seats_by_id_[cat];
-    if (seats.empty())
+    OpTimer timer(*this, Stats::kCheckinSeat);
+    last_seats_.assign(1, -1);
+    if (!n_empty_[static_cast<int>(cat)]) {
+      ASAP_COUNT(stats_.counters.overbooked, 1);
       return AssignResult::kOverbooked;
-    auto seat = std::find_if(seats.begin(), seats.end(),
-			[&seat_no](const std::shared_ptr<Seat>& s){
-			  return s->get_desc() == seat_no;});
-    if (seat != seats.end())
-      (*seat)->set_passenger(std::make_shared<Passenger>
-			     (name, SeatType::kOther, is_minor));
-    else {
-      std::cerr << "seat not found\n";
+    }
+    const int id = seats_->find(seat_no);
+    if (id < 0 || seats_->cabin_of(id).cat != cat || occupied_.test(id)) {
+      ASAP_COUNT(stats_.counters.seat_unavailable, 1);
+      return AssignResult::kSeatUnavailable;
+    }
+    Passenger p(name, SeatType::kOther, is_minor);
+    occupy(id, &p);
+    last_seats_[0] = id;
+    journal_commit();
+    return AssignResult::kOk;
+  }
+
+  bool Flight::cancel(const std::string& seat_no) {
+    const int id = seats_->find(seat_no);
+    if (id < 0 || !occupied_.test(id))
+      return false;
+    vacate(id);
+    release(id);
+    journal_commit();
+    return true;
+  }
+
+  Flight::AssignResult Flight::move(const std::string& from, const std::string& to) {
+    const int i = seats_->find(from);
+    const int j = seats_->find(to);
+    if (i < 0 || j < 0 || !occupied_.test(i) || occupied_.test(j)
+	|| seats_->cabin_of(i).cat != seats_->cabin_of(j).cat) {
+      ASAP_COUNT(stats_.counters.seat_unavailable, 1);
       return AssignResult::kSeatUnavailable;
     }
+    // the passenger keeps its handle
+    const unsigned h = occupants_[i].handle;
+    vacate(i);
+    occupants_[j].handle = h;
+    mark_taken(j);
+    journal_commit();
     return AssignResult::kOk;
   }
 }// namespace asap
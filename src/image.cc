@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        COMPILED LAYOUT IMAGES
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <flight.hpp>
+#include <cstddef>
+#include <cstring>
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace asap {
+  namespace detail {
+    namespace {
+      // Image layout, all numbers in host byte order, sections
+      // aligned to 8 bytes:
+      //   Header
+      //   ImageCabin[n_cabins]
+      //   ImageColumn[n_columns], the columns of all cabins in order
+      //   neighbour offsets, uint32_t[n_seats + 1], and neighbours,
+      //   uint32_t[n_neighbors], see SeatMap::each_neighbor
+      //   seat classes, unsigned char[n_seats]
+      //   distances, unsigned short[n_seats]
+      //   string pool: flight number, then the labels
+      const char image_magic[8] = {'A', 'S', 'A', 'P', 'S', 'M', 'A', 'P'};
+      const uint32_t image_byte_order = 0x01020304;
+
+      struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t size;
+	// checksum() of everything after this field
+	uint32_t checksum;
+	uint32_t n_seats;
+	uint32_t n_cabins;
+	uint32_t n_columns;
+	uint32_t n_neighbors;
+	uint32_t flight_number_size;
+	// zero, keeps the penalties aligned
+	uint32_t unused;
+	double penalties[8];
+      };
+
+      struct ImageCabin {
+	int32_t cat;
+	int32_t first_row;
+	int32_t rows;
+	int32_t center;
+	int32_t first_seat;
+	int32_t row_size;
+      };
+
+      struct ImageColumn {
+	uint32_t label;
+	uint16_t label_size;
+	uint8_t type;
+	// comma separated group, see SeatMap::Cabin::groups
+	uint8_t group;
+      };
+
+      size_t align(size_t n) { return (n + 7) & ~size_t(7); }
+
+      // section offsets, from the counts
+      struct Sections {
+	explicit Sections(const Header& h)
+	  : cabins(align(sizeof(Header))),
+	    columns(align(cabins + h.n_cabins * sizeof(ImageCabin))),
+	    adj_first(align(columns + h.n_columns * sizeof(ImageColumn))),
+	    adj(align(adj_first + (size_t(h.n_seats) + 1) * sizeof(uint32_t))),
+	    classes(align(adj + size_t(h.n_neighbors) * sizeof(uint32_t))),
+	    dists(align(classes + h.n_seats)),
+	    strings(align(dists + h.n_seats * sizeof(unsigned short))) { }
+	size_t cabins, columns, adj_first, adj, classes, dists, strings;
+      };
+
+      const size_t checksum_end = offsetof(Header, checksum) + sizeof(uint32_t);
+
+      // FNV-1a over 64-bit words, in four lanes so the multiplies
+      // overlap, folded to 32 bits. Images of large cabins are mostly
+      // seat tables, which fnv1a on bytes took longer to check than
+      // to build anew.
+      uint32_t checksum(const char* first, const char* last) {
+	const uint64_t prime = 1099511628211u;
+	uint64_t h[4];
+	for (int k = 0; k < 4; ++k)
+	  h[k] = 14695981039346656037u + k;
+	for (; last - first >= 32; first += 32)
+	  for (int k = 0; k < 4; ++k) {
+	    uint64_t w;
+	    std::memcpy(&w, first + 8 * k, sizeof(w));
+	    h[k] = (h[k] ^ w) * prime;
+	  }
+	for (; first != last; ++first)
+	  h[0] = (h[0] ^ static_cast<unsigned char>(*first)) * prime;
+	uint64_t result = h[0];
+	for (int k = 1; k < 4; ++k)
+	  result = (result ^ h[k]) * prime;
+	return static_cast<uint32_t>(result ^ result >> 32);
+      }
+
+      // files smaller than this are read rather than mapped; loading
+      // an image took as long either way at about this size, and
+      // twice as long mapped at the 20 KiB of a large aircraft
+      const size_t map_threshold = 160 * 1024;
+
+      void bad_image() {
+	throw Flight::InputFileFormatError();
+      }
+    }
+
+    uint32_t fnv1a(const char* first, const char* last) {
+      uint32_t h = 2166136261u;
+      for (; first != last; ++first)
+	h = (h ^ static_cast<unsigned char>(*first)) * 16777619u;
+      return h;
+    }
+
+    MappedFile::MappedFile(const std::string& name)
+      : data_(0), size_(0), mapped_(false) {
+#ifdef HAVE_MMAP
+      int fd = ::open(name.c_str(), O_RDONLY);
+      if (fd < 0)
+	throw Flight::FileNotFoundError();
+      struct stat st;
+      const bool regular = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+      // mapping and unmapping costs more than reading a few pages
+      if (regular && static_cast<size_t>(st.st_size) >= map_threshold) {
+	void* p = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+	  data_ = static_cast<const char*>(p);
+	  size_ = st.st_size;
+	  mapped_ = true;
+	}
+      }
+      else if (regular) {
+	buffer_.resize(st.st_size);
+	size_t done = 0;
+	ssize_t n;
+	while (done < buffer_.size()
+	       && (n = ::read(fd, &buffer_[done], buffer_.size() - done)) > 0)
+	  done += n;
+	buffer_.resize(done);
+	data_ = buffer_.data();
+	size_ = done;
+      }
+      ::close(fd);
+      if (regular)
+	return;
+#endif
+      // no mmap, or not a regular file
+      std::ifstream in(name, std::ios::binary);
+      if (!in.is_open())
+	throw Flight::FileNotFoundError();
+      buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+
+    MappedFile::~MappedFile() {
+#ifdef HAVE_MMAP
+      if (mapped_)
+	::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    void compile_layout(const Layout& layout, std::string& image) {
+      SeatMap seats;
+      for (const auto& c : layout.cabins)
+	seats.add_cabin(c);
+      Header h;
+      std::memcpy(h.magic, image_magic, sizeof(h.magic));
+      h.version = layout_image_version;
+      h.byte_order = image_byte_order;
+      h.n_seats = seats.size();
+      h.n_cabins = seats.cabins().size();
+      h.n_columns = 0;
+      for (const auto& c : seats.cabins())
+	h.n_columns += c.row_size();
+      h.n_neighbors = seats.own_adj_.size();
+      h.flight_number_size = layout.flight_number.size();
+      h.unused = 0;
+      const PenaltyWeights& w = layout.penalties;
+      const double penalties[8] = {w.wrong_seat, w.wrong_sec, w.neighbor_seat_occupied,
+				   w.weight, w.non_contiguous, w.balance,
+				   w.neighbor_across_aisle, w.neighbor_front_back};
+      std::memcpy(h.penalties, penalties, sizeof(penalties));
+      const Sections sec(h);
+      image.assign(sec.strings, '\0');
+      image.append(layout.flight_number);
+      size_t col = 0;
+      for (size_t i = 0; i < seats.cabins().size(); ++i) {
+	const SeatMap::Cabin& c = seats.cabins()[i];
+	const ImageCabin ic = {static_cast<int32_t>(c.cat), c.first_row, c.rows,
+			       c.center, c.first_seat, c.row_size()};
+	std::memcpy(&image[sec.cabins + i * sizeof(ImageCabin)], &ic, sizeof(ic));
+	for (int k = 0; k < c.row_size(); ++k, ++col) {
+	  const ImageColumn icol = {static_cast<uint32_t>(image.size() - sec.strings),
+				    static_cast<uint16_t>(c.labels[k].size()),
+				    static_cast<uint8_t>(c.types[k]),
+				    c.groups.empty() ? uint8_t(0) : c.groups[k]};
+	  std::memcpy(&image[sec.columns + col * sizeof(ImageColumn)], &icol, sizeof(icol));
+	  image.append(c.labels[k]);
+	}
+      }
+      // no cabins leave the offsets empty, a single 0 here
+      if (!seats.own_adj_first_.empty())
+	std::memcpy(&image[sec.adj_first], seats.own_adj_first_.data(),
+		    seats.own_adj_first_.size() * sizeof(uint32_t));
+      if (h.n_neighbors)
+	std::memcpy(&image[sec.adj], seats.own_adj_.data(), h.n_neighbors * sizeof(uint32_t));
+      if (h.n_seats) {
+	std::memcpy(&image[sec.classes], seats.class_, h.n_seats);
+	std::memcpy(&image[sec.dists], seats.dist_, h.n_seats * sizeof(unsigned short));
+      }
+      h.size = image.size();
+      std::memcpy(&image[0], &h, sizeof(h));
+      h.checksum = checksum(image.data() + checksum_end, image.data() + image.size());
+      std::memcpy(&image[offsetof(Header, checksum)], &h.checksum, sizeof(h.checksum));
+    }
+
+    bool is_layout_image(const char* data, size_t size) {
+      return size >= sizeof(image_magic)
+	&& !std::memcmp(data, image_magic, sizeof(image_magic));
+    }
+
+    void load_layout_image(const std::shared_ptr<const MappedFile>& file, SeatMap& seats,
+			   std::string& flight_number, PenaltyWeights& penalties) {
+      const char* data = file->data();
+      const size_t size = file->size();
+      Header h;
+      if (size < sizeof(h))
+	bad_image();
+      std::memcpy(&h, data, sizeof(h));
+      if (!is_layout_image(data, size) || h.version != layout_image_version
+	  || h.byte_order != image_byte_order || h.size != size
+	  || h.checksum != checksum(data + checksum_end, data + size))
+	bad_image();
+      // the checksum only guards against damage, the tables are
+      // still checked before they are used
+      const Sections sec(h);
+      if (h.n_cabins > 3 || h.n_seats > size || h.n_columns > size
+	  || h.n_neighbors > size || sec.strings + h.flight_number_size > size)
+	bad_image();
+      const char* strings = data + sec.strings;
+      const size_t n_strings = size - sec.strings;
+      flight_number.assign(strings, h.flight_number_size);
+      penalties.wrong_seat = h.penalties[0];
+      penalties.wrong_sec = h.penalties[1];
+      penalties.neighbor_seat_occupied = h.penalties[2];
+      penalties.weight = h.penalties[3];
+      penalties.non_contiguous = h.penalties[4];
+      penalties.balance = h.penalties[5];
+      penalties.neighbor_across_aisle = h.penalties[6];
+      penalties.neighbor_front_back = h.penalties[7];
+      const unsigned char* classes =
+	reinterpret_cast<const unsigned char*>(data + sec.classes);
+      for (uint32_t i = 0; i < h.n_seats; ++i)
+	if (classes[i] >= n_seat_classes)
+	  bad_image();
+      // neighbour offsets ascending up to n_neighbors, neighbours
+      // within the seats and of a known kind
+      const uint32_t* adj_first = reinterpret_cast<const uint32_t*>(data + sec.adj_first);
+      const uint32_t* adj = reinterpret_cast<const uint32_t*>(data + sec.adj);
+      bool bad = adj_first[0] != 0 || adj_first[h.n_seats] != h.n_neighbors;
+      for (uint32_t i = 0; i < h.n_seats; ++i)
+	bad |= adj_first[i] > adj_first[i + 1];
+      for (uint32_t i = 0; i < h.n_neighbors; ++i)
+	bad |= (adj[i] >> 2) >= h.n_seats || (adj[i] & 3) == 3;
+      if (bad)
+	bad_image();
+      SeatMap result;
+      size_t col = 0;
+      uint32_t n_seats = 0;
+      for (uint32_t i = 0; i < h.n_cabins; ++i) {
+	ImageCabin ic;
+	std::memcpy(&ic, data + sec.cabins + i * sizeof(ic), sizeof(ic));
+	if (ic.cat < 0 || ic.cat > 2 || ic.rows < 0 || ic.row_size < 0
+	    || ic.first_row < 0 || int64_t(ic.first_row) + ic.rows > 100000
+	    || ic.first_seat != static_cast<int32_t>(n_seats)
+	    || col + ic.row_size > h.n_columns
+	    || n_seats + uint64_t(ic.rows) * ic.row_size > h.n_seats)
+	  bad_image();
+	SeatMap::Cabin c;
+	c.cat = static_cast<TravelCategory>(ic.cat);
+	c.first_row = ic.first_row;
+	c.rows = ic.rows;
+	c.center = ic.center;
+	c.first_seat = ic.first_seat;
+	for (int k = 0; k < ic.row_size; ++k, ++col) {
+	  ImageColumn icol;
+	  std::memcpy(&icol, data + sec.columns + col * sizeof(icol), sizeof(icol));
+	  if (uint64_t(icol.label) + icol.label_size > n_strings || icol.type > 2)
+	    bad_image();
+	  c.labels.emplace_back(strings + icol.label, icol.label_size);
+	  c.types.push_back(static_cast<SeatType>(icol.type));
+	  c.groups.push_back(icol.group);
+	}
+	// exit rows, from the first seat of each row
+	if (ic.rows && ic.row_size) {
+	  c.emergency.resize(c.first_row + c.rows);
+	  for (int r = 0; r < c.rows; ++r)
+	    c.emergency[c.first_row + r] = classes[n_seats + r * ic.row_size] % 2;
+	}
+	n_seats += ic.rows * ic.row_size;
+	result.index(c, i);
+	result.cabins_.push_back(std::move(c));
+      }
+      if (n_seats != h.n_seats)
+	bad_image();
+      result.class_ = classes;
+      result.dist_ = reinterpret_cast<const unsigned short*>(data + sec.dists);
+      result.adj_first_ = adj_first;
+      result.adj_ = adj;
+      result.size_ = n_seats;
+      result.image_ = file;
+      seats = std::move(result);
+    }
+  } // namespace detail
+
+  void Flight::compile(const std::string& file, const std::string& image_file) {
+    detail::MappedFile input(file);
+    detail::Layout layout;
+    detail::parse_layout(std::string_view(input.data(), input.size()), layout);
+    std::string image;
+    detail::compile_layout(layout, image);
+    std::ofstream out(image_file, std::ios::binary);
+    if (!out.write(image.data(), image.size()))
+      throw FileNotFoundError();
+  }
+}
@@ -0,0 +1,511 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        CHECK-IN JOURNAL
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <flight.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace asap {
+  namespace detail {
+    namespace {
+      // Journal file: FileHeader, then records
+      //   uint32_t size of payload
+      //   uint32_t checksum, FNV-1a of the payload
+      //   payload: uint64_t seq, entries
+      // Snapshot file: FileHeader, uint64_t seq of the last record it
+      // holds, uint32_t no. of entries, entries, uint32_t checksum of
+      // all before.
+      // An entry is an Op, uint32_t seat id, and for kOccupy uint8_t
+      // seat type, uint8_t minor, uint16_t name size and the name,
+      // at most 65535 bytes of it.
+      // kVacate frees the seat.
+      // All numbers in host byte order.
+      const char journal_magic[8] = {'A', 'S', 'A', 'P', 'J', 'R', 'N', 'L'};
+      const char snapshot_magic[8] = {'A', 'S', 'A', 'P', 'S', 'N', 'A', 'P'};
+      const uint32_t journal_version = 1;
+
+      enum class Op : uint8_t { kOccupy, kVacate };
+
+      struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	// the layout the seat ids belong to
+	uint32_t n_seats;
+	uint32_t flight_number;
+      };
+
+      FileHeader file_header(const char* magic, int n_seats,
+			     const std::string& flight_number) {
+	FileHeader h;
+	std::memcpy(h.magic, magic, sizeof(h.magic));
+	h.version = journal_version;
+	h.byte_order = 0x01020304;
+	h.n_seats = n_seats;
+	h.flight_number = fnv1a(flight_number.data(),
+				flight_number.data() + flight_number.size());
+	return h;
+      }
+
+      template <typename T>
+      void put(std::string& out, const T& v) {
+	out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+      }
+
+      // a name and its size; longer names than the size can hold are
+      // cut to their first 65535 bytes, so the entries after them
+      // stay aligned
+      void put_name(std::string& out, std::string_view name) {
+	name = name.substr(0, std::numeric_limits<uint16_t>::max());
+	put(out, static_cast<uint16_t>(name.size()));
+	out.append(name.data(), name.size());
+      }
+
+      // reads from [p, end), false if there is not enough left
+      struct Reader {
+	const char* p;
+	const char* end;
+	template <typename T>
+	bool get(T& v) {
+	  if (size_t(end - p) < sizeof(v))
+	    return false;
+	  std::memcpy(&v, p, sizeof(v));
+	  p += sizeof(v);
+	  return true;
+	}
+	bool get(std::string_view& s, size_t n) {
+	  if (size_t(end - p) < n)
+	    return false;
+	  s = std::string_view(p, n);
+	  p += n;
+	  return true;
+	}
+      };
+
+      void bad_journal() {
+	throw Flight::InputFileFormatError();
+      }
+
+      void write_all(int fd, const char* data, size_t n) {
+	while (n) {
+	  const ssize_t k = ::write(fd, data, n);
+	  if (k < 0)
+	    throw Flight::FileNotFoundError();
+	  data += k;
+	  n -= k;
+	}
+      }
+
+      void sync_fd(int fd) {
+#ifdef HAVE_FDATASYNC
+	::fdatasync(fd);
+#else
+	::fsync(fd);
+#endif
+      }
+
+      bool exists(const std::string& file) {
+	struct stat st;
+	return ::stat(file.c_str(), &st) == 0;
+      }
+
+      // written next to file and renamed into place once it is on
+      // disk, so a crash leaves the old snapshot or the new one
+      void write_snapshot(const std::string& file, const std::string& image) {
+	const std::string tmp = file + ".tmp";
+	const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	  throw Flight::FileNotFoundError();
+	try {
+	  write_all(fd, image.data(), image.size());
+	}
+	catch (...) {
+	  ::close(fd);
+	  throw;
+	}
+	sync_fd(fd);
+	::close(fd);
+	if (std::rename(tmp.c_str(), file.c_str()))
+	  throw Flight::FileNotFoundError();
+      }
+
+      // the highest seq held by a snapshot or journal of the flight
+      // with these headers, 0 if there are none; damaged files count
+      // for what can be read of them
+      uint64_t last_seq(const std::string& file, const std::string& snapshot_file,
+			const FileHeader& journal, const FileHeader& snapshot) {
+	uint64_t result = 0;
+	FileHeader h;
+	if (exists(snapshot_file)) {
+	  MappedFile in(snapshot_file);
+	  Reader r = {in.data(), in.data() + in.size()};
+	  uint64_t seq;
+	  if (r.get(h) && !std::memcmp(&h, &snapshot, sizeof(h)) && r.get(seq))
+	    result = seq;
+	}
+	if (exists(file)) {
+	  MappedFile in(file);
+	  Reader r = {in.data(), in.data() + in.size()};
+	  if (!r.get(h) || std::memcmp(&h, &journal, sizeof(h)))
+	    return result;
+	  for (;;) {
+	    uint32_t size, checksum;
+	    uint64_t seq;
+	    if (!r.get(size) || !r.get(checksum) || size < sizeof(seq)
+		|| size_t(r.end - r.p) < size || checksum != fnv1a(r.p, r.p + size))
+	      break;
+	    std::memcpy(&seq, r.p, sizeof(seq));
+	    result = std::max(result, seq);
+	    r.p += size;
+	  }
+	}
+	return result;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////
+    //
+    // The open journal of a flight. The flight adds the seats of a
+    // check-in, commit turns them into a record and queues it. A
+    // writer thread takes all queued records at once, writes them
+    // and syncs the file (group commit), so records queued meanwhile
+    // go out with the next write. A snapshot is queued the same way,
+    // behind the records it covers; the writer then replaces the
+    // snapshot file and empties the journal.
+
+    class Journal {
+    public:
+      Journal(int fd, uint64_t seq, size_t snapshot_every, std::string snapshot_file)
+	: fd_(fd), snapshot_file_(std::move(snapshot_file)),
+	  snapshot_every_(snapshot_every), since_snapshot_(0), seq_(seq),
+	  n_entries_(0), snapshot_at_(0), has_snapshot_(false),
+	  queued_(0), written_(0), failed_(false), stop_(false),
+	  writer_([this]() { run(); }) { }
+      ~Journal() {
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  stop_ = true;
+	}
+	work_cv_.notify_one();
+	writer_.join();
+	::close(fd_);
+      }
+      void add(int id, std::string_view name, SeatType type, bool minor) {
+	put(entries_, Op::kOccupy);
+	put(entries_, static_cast<uint32_t>(id));
+	put(entries_, static_cast<uint8_t>(type));
+	put(entries_, static_cast<uint8_t>(minor));
+	put_name(entries_, name);
+	++n_entries_;
+      }
+      void add_vacate(int id) {
+	put(entries_, Op::kVacate);
+	put(entries_, static_cast<uint32_t>(id));
+	++n_entries_;
+      }
+      // queue the entries added since the last commit as one record,
+      // true if a snapshot is due
+      bool commit() {
+	if (!n_entries_)
+	  return false;
+	++seq_;
+	record_.clear();
+	put(record_, static_cast<uint32_t>(sizeof(seq_) + entries_.size()));
+	put(record_, uint32_t(0));
+	put(record_, seq_);
+	record_.append(entries_);
+	const uint32_t checksum = fnv1a(record_.data() + 8, record_.data() + record_.size());
+	std::memcpy(&record_[4], &checksum, sizeof(checksum));
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  queue_.append(record_);
+	  ++queued_;
+	}
+	work_cv_.notify_one();
+	entries_.clear();
+	n_entries_ = 0;
+	return snapshot_every_ && ++since_snapshot_ >= snapshot_every_;
+      }
+      // queue a snapshot, taken after the last record committed
+      void snapshot(std::string image) {
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  snapshot_.swap(image);
+	  snapshot_at_ = queue_.size();
+	  has_snapshot_ = true;
+	  ++queued_;
+	}
+	work_cv_.notify_one();
+	since_snapshot_ = 0;
+      }
+      void sync() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	const uint64_t target = queued_;
+	done_cv_.wait(lock, [&]() { return written_ >= target || failed_; });
+	if (failed_)
+	  throw Flight::FileNotFoundError();
+      }
+      uint64_t seq() const { return seq_; }
+    private:
+      void run() {
+	std::string batch, image;
+	for (;;) {
+	  std::unique_lock<std::mutex> lock(mutex_);
+	  work_cv_.wait(lock, [this]() {
+	      return stop_ || !queue_.empty() || has_snapshot_; });
+	  if (queue_.empty() && !has_snapshot_)
+	    return;
+	  batch.swap(queue_);
+	  image.swap(snapshot_);
+	  const bool has_snapshot = has_snapshot_;
+	  const size_t at = snapshot_at_;
+	  has_snapshot_ = false;
+	  const uint64_t target = queued_;
+	  lock.unlock();
+	  bool ok = !failed_;
+	  if (ok)
+	    try {
+	      if (has_snapshot) {
+		// the records before the snapshot have to be on disk
+		// before it replaces the old one
+		write_all(fd_, batch.data(), at);
+		sync_fd(fd_);
+		write_snapshot(snapshot_file_, image);
+		if (::ftruncate(fd_, sizeof(FileHeader))
+		    || ::lseek(fd_, 0, SEEK_END) < 0)
+		  throw Flight::FileNotFoundError();
+		write_all(fd_, batch.data() + at, batch.size() - at);
+	      }
+	      else
+		write_all(fd_, batch.data(), batch.size());
+	      sync_fd(fd_);
+	    }
+	    catch (Flight::FileNotFoundError&) {
+	      ok = false;
+	    }
+	  batch.clear();
+	  image.clear();
+	  lock.lock();
+	  failed_ = !ok;
+	  written_ = target;
+	  done_cv_.notify_all();
+	}
+      }
+      const int fd_;
+      const std::string snapshot_file_;
+      const size_t snapshot_every_;
+      // used by the flight's thread only
+      size_t since_snapshot_;
+      uint64_t seq_;
+      std::string entries_;
+      uint32_t n_entries_;
+      std::string record_;
+      // shared with the writer
+      std::mutex mutex_;
+      std::condition_variable work_cv_, done_cv_;
+      std::string queue_;
+      std::string snapshot_;
+      size_t snapshot_at_;
+      bool has_snapshot_;
+      uint64_t queued_, written_;
+      bool failed_;
+      bool stop_;
+      std::thread writer_;
+    };
+
+    JournalRef::JournalRef() { }
+    JournalRef::JournalRef(const JournalRef&) { }
+    JournalRef::JournalRef(JournalRef&&) = default;
+    JournalRef& JournalRef::operator=(const JournalRef&) {
+      journal_.reset();
+      return *this;
+    }
+    JournalRef& JournalRef::operator=(JournalRef&&) = default;
+    JournalRef::~JournalRef() { }
+    void JournalRef::reset(Journal* journal) { journal_.reset(journal); }
+  } // namespace detail
+
+  void Flight::journal_seat(int id) {
+    const unsigned h = occupants_[id].handle;
+    if (use_arena_)
+      journal_.get()->add(id, arena_.name(h), arena_.type(h), arena_.is_minor(h));
+    else
+      journal_.get()->add(id, passengers_[h]->get_name(), passengers_[h]->get_seat_type(),
+			  passengers_[h]->is_minor());
+  }
+
+  void Flight::journal_vacate(int id) {
+    journal_.get()->add_vacate(id);
+  }
+
+  void Flight::journal_commit() {
+    if (journal_.get() && journal_.get()->commit())
+      snapshot();
+  }
+
+  std::string Flight::snapshot_image(uint64_t seq) const {
+    std::string image;
+    detail::put(image, detail::file_header(detail::snapshot_magic, seats_->size(), flight_number_));
+    detail::put(image, seq);
+    const size_t count_at = image.size();
+    detail::put(image, uint32_t(0));
+    uint32_t count = 0;
+    for (int id = 0; id < seats_->size(); ++id) {
+      if (!occupied_.test(id))
+	continue;
+      const unsigned h = occupants_[id].handle;
+      const std::string_view name = use_arena_ ? arena_.name(h)
+	: std::string_view(passengers_[h]->get_name());
+      detail::put(image, detail::Op::kOccupy);
+      detail::put(image, static_cast<uint32_t>(id));
+      detail::put(image, static_cast<uint8_t>(use_arena_ ? arena_.type(h)
+				      : passengers_[h]->get_seat_type()));
+      detail::put(image, static_cast<uint8_t>(use_arena_ ? arena_.is_minor(h)
+				      : passengers_[h]->is_minor()));
+      detail::put_name(image, name);
+      ++count;
+    }
+    std::memcpy(&image[count_at], &count, sizeof(count));
+    detail::put(image, detail::fnv1a(image.data(), image.data() + image.size()));
+    return image;
+  }
+
+  void Flight::open_journal(const std::string& file, size_t snapshot_every) {
+    journal_.reset();
+    const std::string snapshot_file = file + ".snap";
+    int n_empty = 0;
+    for (int n : n_empty_)
+      n_empty += n;
+    const bool empty = n_empty == seats_->size();
+    // seat and unseat the passengers of the entries in r, returns
+    // their number
+    auto apply = [this](detail::Reader& r) {
+      uint32_t count = 0;
+      for (; r.p != r.end; ++count) {
+	detail::Op op;
+	uint32_t id;
+	if (!r.get(op) || !r.get(id) || id >= static_cast<uint32_t>(seats_->size()))
+	  detail::bad_journal();
+	if (op == detail::Op::kVacate) {
+	  if (!occupied_.test(id))
+	    detail::bad_journal();
+	  vacate(id);
+	  release(id);
+	  continue;
+	}
+	uint8_t type, minor;
+	uint16_t size;
+	std::string_view name;
+	if (op != detail::Op::kOccupy || !r.get(type) || !r.get(minor) || !r.get(size)
+	    || !r.get(name, size) || occupied_.test(id) || type > 2)
+	  detail::bad_journal();
+	Passenger p(std::string(name), static_cast<SeatType>(type), minor);
+	occupy(id, &p);
+      }
+      return count;
+    };
+    uint64_t seq = 0;
+    size_t end = 0; // of the valid records, 0 for a new journal
+    if (empty && detail::exists(snapshot_file)) {
+      detail::MappedFile in(snapshot_file);
+      const detail::FileHeader expected =
+	detail::file_header(detail::snapshot_magic, seats_->size(), flight_number_);
+      detail::FileHeader h;
+      uint32_t count, checksum;
+      detail::Reader r = {in.data(), in.data() + in.size()};
+      if (in.size() < sizeof(checksum))
+	detail::bad_journal();
+      r.end -= sizeof(checksum);
+      std::memcpy(&checksum, r.end, sizeof(checksum));
+      if (!r.get(h) || std::memcmp(&h, &expected, sizeof(h)) || !r.get(seq) || !r.get(count)
+	  || checksum != detail::fnv1a(in.data(), r.end) || apply(r) != count)
+	detail::bad_journal();
+    }
+    if (empty && detail::exists(file)) {
+      detail::MappedFile in(file);
+      const detail::FileHeader expected =
+	detail::file_header(detail::journal_magic, seats_->size(), flight_number_);
+      detail::FileHeader h;
+      detail::Reader r = {in.data(), in.data() + in.size()};
+      if (in.size()) {
+	if (!r.get(h) || std::memcmp(&h, &expected, sizeof(h)))
+	  detail::bad_journal();
+	end = r.p - in.data();
+      }
+      // a record that is cut short or does not match its checksum
+      // ends the journal, it was being written during the crash
+      for (;;) {
+	uint32_t size, checksum;
+	uint64_t record_seq;
+	if (!r.get(size) || !r.get(checksum) || size < sizeof(record_seq)
+	    || size_t(r.end - r.p) < size
+	    || checksum != detail::fnv1a(r.p, r.p + size))
+	  break;
+	detail::Reader record = {r.p, r.p + size};
+	r.p += size;
+	record.get(record_seq);
+	// records before the snapshot were left by a crash before the
+	// journal was emptied
+	if (record_seq > seq) {
+	  apply(record);
+	  seq = record_seq;
+	}
+	end = r.p - in.data();
+      }
+    }
+    // passengers seated before the journal only get into a snapshot.
+    // It has to be on disk before the journal is emptied, with a seq
+    // past the records left in it, which replay then skips.
+    if (!empty) {
+      seq = detail::last_seq(file, snapshot_file,
+			     detail::file_header(detail::journal_magic, seats_->size(),
+						 flight_number_),
+			     detail::file_header(detail::snapshot_magic, seats_->size(),
+						 flight_number_));
+      detail::write_snapshot(snapshot_file, snapshot_image(seq));
+    }
+    const int fd = ::open(file.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+      throw FileNotFoundError();
+    if (::ftruncate(fd, end) || ::lseek(fd, 0, SEEK_END) < 0) {
+      ::close(fd);
+      throw FileNotFoundError();
+    }
+    if (!end) {
+      const detail::FileHeader h =
+	detail::file_header(detail::journal_magic, seats_->size(), flight_number_);
+      try {
+	detail::write_all(fd, reinterpret_cast<const char*>(&h), sizeof(h));
+      }
+      catch (...) {
+	::close(fd);
+	throw;
+      }
+    }
+    journal_.reset(new detail::Journal(fd, seq, snapshot_every, snapshot_file));
+  }
+
+  void Flight::snapshot() {
+    if (detail::Journal* j = journal_.get())
+      j->snapshot(snapshot_image(j->seq()));
+  }
+
+  void Flight::sync_journal() {
+    if (detail::Journal* j = journal_.get())
+      j->sync();
+  }
+}
@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        PASSENGER MANIFEST READER
+
+#include <flight.hpp>
+#include <cctype>
+#include <cstring>
+
+namespace asap {
+  namespace {
+    inline bool is_space(char c) {
+      return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    // splits line into up to n white space separated tokens, returns
+    // how many there are, counting those beyond n
+    size_t split(std::string_view line, std::string_view* tokens, size_t n) {
+      size_t count = 0;
+      size_t i = 0;
+      for (;;) {
+	while (i < line.size() && is_space(line[i])) ++i;
+	if (i == line.size())
+	  return count;
+	const size_t first = i;
+	while (i < line.size() && !is_space(line[i])) ++i;
+	if (count < n)
+	  tokens[count] = line.substr(first, i - first);
+	++count;
+      }
+    }
+
+    [[noreturn]] void error(int line, std::string_view text, std::string_view at,
+			    const std::string& message) {
+      throw Flight::ParseError(line, at.data() - text.data() + 1, message);
+    }
+
+    const std::string& lower(std::string_view s, std::string& word) {
+      word.assign(s.data(), s.size());
+      std::transform(word.begin(), word.end(), word.begin(),
+		     [](unsigned char c) { return std::tolower(c); });
+      return word;
+    }
+  }
+
+  ManifestReader::ManifestReader(const std::string& file, size_t chunk)
+    : in_(&std::cin), chunk_(std::max<size_t>(chunk, 1)), first_(0), last_(0),
+      line_(0), pending_(false), cat_(TravelCategory::kEconomy), cat_line_(0) {
+    if (file != "-") {
+      file_.reset(new std::ifstream(file, std::ios::binary));
+      if (!file_->is_open())
+	throw Flight::FileNotFoundError();
+      in_ = file_.get();
+    }
+  }
+
+  ManifestReader::ManifestReader(std::istream& in, size_t chunk)
+    : in_(&in), chunk_(std::max<size_t>(chunk, 1)), first_(0), last_(0),
+      line_(0), pending_(false), cat_(TravelCategory::kEconomy), cat_line_(0) { }
+
+  bool ManifestReader::next_line(std::string_view& line) {
+    for (size_t scanned = first_;;) {
+      const char* nl = last_ == scanned ? 0 : static_cast<const char*>(
+	std::memchr(buffer_.data() + scanned, '\n', last_ - scanned));
+      if (nl) {
+	line = std::string_view(buffer_.data() + first_, nl - buffer_.data() - first_);
+	first_ = nl - buffer_.data() + 1;
+	++line_;
+	return true;
+      }
+      scanned = last_;
+      if (!*in_) {
+	// the last line need not end in a newline
+	if (first_ == last_)
+	  return false;
+	line = std::string_view(buffer_.data() + first_, last_ - first_);
+	first_ = last_;
+	++line_;
+	return true;
+      }
+      // keep the partial line, and read the next chunk behind it
+      std::memmove(buffer_.data(), buffer_.data() + first_, last_ - first_);
+      last_ -= first_;
+      scanned -= first_;
+      first_ = 0;
+      if (buffer_.size() < last_ + chunk_)
+	buffer_.resize(last_ + chunk_);
+      in_->read(buffer_.data() + last_, chunk_);
+      last_ += in_->gcount();
+    }
+  }
+
+  bool ManifestReader::category(std::string_view line) {
+    std::string_view t;
+    const size_t n = split(line, &t, 1);
+    if (n != 1)
+      return false;
+    if (!detail::CatMap::instance().is_valid_cat(lower(t, word_)))
+      error(line_, line, t, "unknown travel category '" + std::string(t) + "'");
+    cat_ = detail::CatMap::instance().cat(word_);
+    cat_line_ = line_;
+    pending_ = true;
+    return true;
+  }
+
+  bool ManifestReader::next(PassengerGroup& group) {
+    const detail::CatMap& names = detail::CatMap::instance();
+    std::string_view line;
+    std::string_view t[4];
+    while (!pending_) {
+      if (!next_line(line))
+	return false;
+      const size_t n = split(line, t, 1);
+      if (!n || t[0][0] == '#')
+	continue;
+      if (!category(line))
+	error(line_, line, t[0], "passenger before any travel category");
+    }
+    group = PassengerGroup(cat_);
+    pending_ = false;
+    const int first_line = cat_line_;
+    while (next_line(line)) {
+      const size_t n = split(line, t, 4);
+      if (!n || t[0][0] == '#')
+	continue;
+      if (n == 1) {
+	category(line);
+	break;
+      }
+      if (n > 3)
+	error(line_, line, t[3], "unexpected '" + std::string(t[3]) + "'");
+      if (n < 3)
+	error(line_, line, line.substr(line.size()), "expected 'adult' or 'minor'");
+      if (!names.is_valid_type(lower(t[1], word_)))
+	error(line_, line, t[1], "unknown seat type '" + std::string(t[1]) + "'");
+      const SeatType type = names.type(word_);
+      lower(t[2], word_);
+      if (word_ != "adult" && word_ != "minor")
+	error(line_, line, t[2], "expected 'adult' or 'minor'");
+      group.push(std::string(t[0]), type, word_ == "minor");
+    }
+    if (!group.size())
+      throw Flight::ParseError(first_line, 1, "group without passengers");
+    return true;
+  }
+
+  PassengerGroup::PassengerGroup(const std::string& file)
+    : cat_(TravelCategory::kEconomy) {
+    ManifestReader r(file);
+    if (!r.next(*this))
+      throw Flight::ParseError(r.line() + 1, 1, "expected travel category");
+    // a following group stopped the first one at its category line
+    const int line = r.line();
+    PassengerGroup more(cat_);
+    if (r.next(more))
+      throw Flight::ParseError(line, 1, "more than one group, use ManifestReader");
+  }
+}
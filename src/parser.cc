@@ -0,0 +1,207 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        FLIGHT FILE PARSER
+
+#include <flight.hpp>
+#include <charconv>
+
+namespace asap {
+  Flight::ParseError::ParseError(int line, int column, const std::string& message)
+    : line_(line), column_(column),
+      what_("line " + std::to_string(line) + ", column " + std::to_string(column)
+	    + ": " + message) { }
+
+  namespace detail {
+    namespace {
+      // the same limit SeatMap::find has on row numbers
+      const int max_row = 100000;
+
+      enum class Keyword { kUnknown, kFlight, kFirst, kBusiness, kEconomy,
+	  kRows, kEmergency, kSeats, kCenter, kPenalty };
+
+      inline char lower(char c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+      }
+
+      // case insensitive, word has to be lower case
+      bool equals(std::string_view s, const char* word) {
+	for (char c : s)
+	  if (lower(c) != *word++)
+	    return false;
+	return !*word;
+      }
+
+      Keyword keyword(std::string_view s) {
+	if (s.empty())
+	  return Keyword::kUnknown;
+	// length and first letter tell all keywords apart, the
+	// compare only rules out other words
+	Keyword k = Keyword::kUnknown;
+	const char* word = 0;
+	switch (s.size() * 32 + (lower(s[0]) & 31)) {
+	case 4 * 32 + ('r' & 31): k = Keyword::kRows; word = "rows"; break;
+	case 5 * 32 + ('f' & 31): k = Keyword::kFirst; word = "first"; break;
+	case 5 * 32 + ('s' & 31): k = Keyword::kSeats; word = "seats"; break;
+	case 6 * 32 + ('f' & 31): k = Keyword::kFlight; word = "flight"; break;
+	case 6 * 32 + ('c' & 31): k = Keyword::kCenter; word = "center"; break;
+	case 7 * 32 + ('e' & 31): k = Keyword::kEconomy; word = "economy"; break;
+	case 7 * 32 + ('p' & 31): k = Keyword::kPenalty; word = "penalty"; break;
+	case 8 * 32 + ('b' & 31): k = Keyword::kBusiness; word = "business"; break;
+	case 9 * 32 + ('e' & 31): k = Keyword::kEmergency; word = "emergency"; break;
+	default: return Keyword::kUnknown;
+	}
+	return equals(s, word) ? k : Keyword::kUnknown;
+      }
+
+      inline bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+      }
+
+      // characters of a seat label, as the regex \w had it
+      inline bool is_label(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+	  || (c >= '0' && c <= '9') || c == '_';
+      }
+
+      class Parser {
+      public:
+	explicit Parser(std::string_view text) : text_(text), pos_(0) { }
+	// next white space separated token, empty at the end
+	std::string_view token() {
+	  while (pos_ < text_.size() && is_space(text_[pos_])) ++pos_;
+	  const size_t first = pos_;
+	  while (pos_ < text_.size() && !is_space(text_[pos_])) ++pos_;
+	  return text_.substr(first, pos_ - first);
+	}
+	// the rest of the current line
+	std::string_view line() {
+	  const size_t first = pos_;
+	  while (pos_ < text_.size() && text_[pos_] != '\n') ++pos_;
+	  return text_.substr(first, pos_ - first);
+	}
+	template <typename T>
+	T number(const char* what) {
+	  std::string_view t = token();
+	  T result;
+	  auto r = std::from_chars(t.data(), t.data() + t.size(), result);
+	  if (t.empty() || r.ec != std::errc() || r.ptr != t.data() + t.size())
+	    error(t, std::string("expected ") + what);
+	  return result;
+	}
+	// line and column are only needed here, so they are counted
+	// here rather than kept up to date while scanning
+	[[noreturn]] void error(std::string_view at, const std::string& message) const {
+	  const size_t pos = at.data() - text_.data();
+	  int line = 1;
+	  size_t line_start = 0;
+	  for (size_t i = 0; i < pos; ++i)
+	    if (text_[i] == '\n') {
+	      ++line;
+	      line_start = i + 1;
+	    }
+	  throw Flight::ParseError(line, pos - line_start + 1, message);
+	}
+      private:
+	std::string_view text_;
+	size_t pos_;
+      };
+
+      void add_seats(Parser& p, std::string_view line, SeatMap::Cabin& c) {
+	size_t i = 0;
+	while (i <= line.size()) {
+	  // one group, up to the next comma
+	  const size_t first = c.labels.size();
+	  const size_t group = i;
+	  const unsigned char index = c.groups.empty() ? 0 : c.groups.back() + 1;
+	  for (; i < line.size() && line[i] != ','; ++i) {
+	    if (!is_label(line[i]))
+	      continue;
+	    size_t j = i;
+	    while (j < line.size() && is_label(line[j])) ++j;
+	    c.labels.emplace_back(line.substr(i, j - i));
+	    c.types.push_back(SeatType::kOther);
+	    c.groups.push_back(index);
+	    i = j - 1;
+	  }
+	  if (c.labels.size() == first)
+	    p.error(line.substr(std::min(group, line.size())), "empty seat group");
+	  // mark first and last place in group as aisle
+	  c.types[first] = SeatType::kAisle;
+	  c.types.back() = SeatType::kAisle;
+	  ++i;
+	}
+	// mark first and last place in row as window
+	c.types.front() = SeatType::kWindow;
+	c.types.back() = SeatType::kWindow;
+      }
+    }
+
+    void parse_layout(std::string_view text, Layout& result) {
+      Parser p(text);
+      std::string_view t = p.token();
+      if (keyword(t) != Keyword::kFlight)
+	p.error(t, "expected 'flight'");
+      result.flight_number = p.token();
+      std::array<SeatMap::Cabin, 3> cabins{};
+      SeatMap::Cabin* cabin = 0;
+      int total_rows = 1; // start seat numbering with one
+      while (!(t = p.token()).empty()) {
+	const Keyword k = keyword(t);
+	switch (k) {
+	case Keyword::kFirst:
+	case Keyword::kBusiness:
+	case Keyword::kEconomy: {
+	  const TravelCategory cat = k == Keyword::kFirst ? TravelCategory::kFirst
+	    : k == Keyword::kBusiness ? TravelCategory::kBusiness : TravelCategory::kEconomy;
+	  cabin = &cabins[static_cast<int>(cat)];
+	  cabin->cat = cat;
+	  break;
+	}
+	case Keyword::kRows:
+	case Keyword::kEmergency:
+	case Keyword::kSeats:
+	case Keyword::kCenter:
+	  if (!cabin)
+	    p.error(t, "'" + std::string(t) + "' before any travel category");
+	  if (k == Keyword::kRows) {
+	    cabin->rows = p.number<int>("no. of rows");
+	    if (cabin->rows < 0 || total_rows + cabin->rows > max_row)
+	      p.error(t, "no. of rows out of range");
+	    cabin->first_row = total_rows;
+	    total_rows += cabin->rows;
+	  }
+	  else if (k == Keyword::kEmergency) {
+	    const int row = p.number<int>("row no.");
+	    if (row < 0 || row >= max_row)
+	      p.error(t, "row no. out of range");
+	    if (cabin->emergency.size() <= static_cast<size_t>(row))
+	      cabin->emergency.resize(row + 1);
+	    cabin->emergency[row] = true;
+	  }
+	  else if (k == Keyword::kSeats)
+	    add_seats(p, p.line(), *cabin);
+	  else
+	    cabin->center = p.number<int>("center row");
+	  break;
+	case Keyword::kPenalty: {
+	  std::string name(p.token());
+	  for (auto& c : name)
+	    c = lower(c);
+	  std::string_view at = t;
+	  const double value = p.number<double>("penalty weight");
+	  if (!result.penalties.set(name, value))
+	    p.error(at, "no penalty weight '" + name + "'");
+	  break;
+	}
+	default: // ignore unknown commands
+	  break;
+	}
+      }
+      result.cabins.clear();
+      for (auto& c : cabins)
+	if (c.first_row) // no rows given, no cabin
+	  result.cabins.push_back(std::move(c));
+    }
+  }
+}
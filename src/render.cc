@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        SEAT MAP RENDERER
+
+#include <flight.hpp>
+#include <charconv>
+#include <cstring>
+
+namespace asap {
+  namespace {
+    inline void write(std::string& out, const char* data, size_t n) { out.append(data, n); }
+    inline void write(std::ostream& out, const char* data, size_t n) { out.write(data, n); }
+
+    // writes to a string or stream, through a buffer on the stack;
+    // a string only allocates while it grows
+    template <typename Out>
+    class Writer {
+    public:
+      explicit Writer(Out& out) : out_(out), n_(0) { }
+      ~Writer() { flush(); }
+      void put(std::string_view s) {
+	if (n_ + s.size() > sizeof(buffer_)) {
+	  flush();
+	  if (s.size() > sizeof(buffer_))
+	    return write(out_, s.data(), s.size());
+	}
+	std::memcpy(buffer_ + n_, s.data(), s.size());
+	n_ += s.size();
+      }
+      void put(char c) {
+	if (n_ == sizeof(buffer_))
+	  flush();
+	buffer_[n_++] = c;
+      }
+    private:
+      void flush() {
+	write(out_, buffer_, n_);
+	n_ = 0;
+      }
+      Out& out_;
+      char buffer_[4096];
+      size_t n_;
+    };
+
+    template <typename Sink>
+    void put_int(Sink& out, int i) {
+      char buffer[16];
+      const auto r = std::to_chars(buffer, buffer + sizeof(buffer), i);
+      out.put(std::string_view(buffer, r.ptr - buffer));
+    }
+
+    template <typename Sink>
+    void put_json(Sink& out, std::string_view s) {
+      static const char hex[] = "0123456789abcdef";
+      out.put('"');
+      for (char c : s) {
+	if (c == '"' || c == '\\') {
+	  out.put('\\');
+	  out.put(c);
+	}
+	else if (static_cast<unsigned char>(c) < 0x20) {
+	  out.put("\\u00");
+	  out.put(hex[c >> 4]);
+	  out.put(hex[c & 15]);
+	}
+	else
+	  out.put(c);
+      }
+      out.put('"');
+    }
+
+    template <typename Sink>
+    void put_csv(Sink& out, std::string_view s) {
+      if (s.find_first_of(",\"\r\n") == std::string_view::npos)
+	return out.put(s);
+      out.put('"');
+      for (char c : s) {
+	if (c == '"')
+	  out.put('"');
+	out.put(c);
+      }
+      out.put('"');
+    }
+
+    // the words of passenger files, rather than the letters of show
+    const char* type_name(SeatType t) {
+      return t == SeatType::kWindow ? "window" : t == SeatType::kAisle ? "aisle" : "none";
+    }
+  }
+
+  std::string_view Flight::passenger_name(int id) const {
+    const unsigned h = occupants_[id].handle;
+    if (use_arena_)
+      return arena_.name(h);
+    return passengers_[h]->get_name();
+  }
+
+  template <typename Sink>
+  void Flight::render_to(Sink& out, RenderFormat format) const {
+    const detail::CatMap& names = detail::CatMap::instance();
+    // the letters show uses for seat types, looked up once
+    const std::string letters[3] = {names.desc(SeatType::kWindow),
+				    names.desc(SeatType::kAisle),
+				    names.desc(SeatType::kOther)};
+    if (format == RenderFormat::kText) {
+      out.put("FLIGHT ");
+      out.put(flight_number_);
+      out.put('\n');
+    }
+    else if (format == RenderFormat::kJson) {
+      out.put("{\"flight\":");
+      put_json(out, flight_number_);
+      out.put(",\"cabins\":[");
+    }
+    else
+      out.put("category,row,seat,type,exit,passenger\n");
+    bool first_cabin = true;
+    for (const auto& c : seats_->cabins()) {
+      const std::string category = names.desc(c.cat);
+      if (format == RenderFormat::kText) {
+	out.put("---------  ");
+	out.put(category);
+	out.put("  ---------\n");
+      }
+      else if (format == RenderFormat::kJson) {
+	out.put(first_cabin ? "{\"category\":" : ",{\"category\":");
+	put_json(out, category);
+	out.put(",\"rows\":[");
+      }
+      first_cabin = false;
+      for (int row = 0; row < c.rows; ++row) {
+	const int number = row + c.first_row;
+	if (format == RenderFormat::kText) {
+	  put_int(out, number);
+	  out.put(": ");
+	}
+	else if (format == RenderFormat::kJson) {
+	  out.put(row ? ",{\"row\":" : "{\"row\":");
+	  put_int(out, number);
+	  out.put(",\"seats\":[");
+	}
+	for (int col = 0; col < c.row_size(); ++col) {
+	  const int id = seats_->at(c, row, col);
+	  const SeatType type = c.types[col];
+	  const bool exit = seats_->is_exit(id);
+	  const bool taken = occupied_.test(id);
+	  if (format == RenderFormat::kText) {
+	    put_int(out, number);
+	    out.put(c.labels[col]);
+	    out.put('(');
+	    out.put(letters[static_cast<int>(type)]);
+	    out.put(exit ? "E)::" : ")::");
+	    out.put(taken ? passenger_name(id) : "----");
+	    out.put(", ");
+	  }
+	  else if (format == RenderFormat::kJson) {
+	    out.put(col ? ",{\"seat\":\"" : "{\"seat\":\"");
+	    put_int(out, number);
+	    out.put(c.labels[col]);
+	    out.put("\",\"type\":\"");
+	    out.put(type_name(type));
+	    out.put(exit ? "\",\"exit\":true,\"passenger\":" : "\",\"exit\":false,\"passenger\":");
+	    if (taken)
+	      put_json(out, passenger_name(id));
+	    else
+	      out.put("null");
+	    out.put('}');
+	  }
+	  else {
+	    out.put(category);
+	    out.put(',');
+	    put_int(out, number);
+	    out.put(',');
+	    put_int(out, number);
+	    out.put(c.labels[col]);
+	    out.put(',');
+	    out.put(type_name(type));
+	    out.put(exit ? ",1," : ",0,");
+	    if (taken)
+	      put_csv(out, passenger_name(id));
+	    out.put('\n');
+	  }
+	}
+	if (format == RenderFormat::kText)
+	  out.put('\n');
+	else if (format == RenderFormat::kJson)
+	  out.put("]}");
+      }
+      if (format == RenderFormat::kJson)
+	out.put("]}");
+    }
+    if (format == RenderFormat::kJson)
+      out.put("]}\n");
+  }
+
+  void Flight::render(std::string& out, RenderFormat format) const {
+    Writer<std::string> sink(out);
+    render_to(sink, format);
+  }
+
+  void Flight::render(std::ostream& out, RenderFormat format) const {
+    Writer<std::ostream> sink(out);
+    render_to(sink, format);
+  }
+
+  void Flight::show() {
+    render(std::cout);
+    std::cout.flush();
+  } // Flight::show
+}
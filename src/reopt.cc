@@ -0,0 +1,250 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        RE-OPTIMIZATION OF A SEATING
+
+#include <flight.hpp>
+
+namespace asap {
+  namespace detail {
+    LocalSearch::LocalSearch(const SeatMap& seats, const PenaltyWeights& policy,
+			     NeighborMode mode)
+      : seats_(seats), policy_(policy), mode_(mode), who_(seats.size(), -1),
+	cost_(seats.size()), cabin_(seats.size()),
+	moment_(seats.cabins().size(), {{0, 0}}), stamp_(0) {
+      for (int pc = 0; pc < n_passenger_classes; ++pc)
+	for (int sc = 0; sc < n_seat_classes; ++sc)
+	  pen_[pc][sc] = penalty(static_cast<SeatType>(sc / 2), sc % 2,
+				 static_cast<SeatType>(pc % 3), pc < 3, policy);
+      for (size_t k = 0; k < seats.cabins().size(); ++k) {
+	const SeatMap::Cabin& c = seats.cabins()[k];
+	for (int id = c.first_seat; id < c.first_seat + c.seats(); ++id) {
+	  cost_[id] = policy.weight * seats.dist(id);
+	  cabin_[id] = k;
+	}
+      }
+    }
+
+    void LocalSearch::add(int id, int pc, uint32_t group) {
+      int g = groups_.size();
+      // those who chose their seat are a group of their own
+      if (group)
+	g = group_index_.emplace(group, g).first->second;
+      if (g == static_cast<int>(groups_.size())) {
+	groups_.emplace_back();
+	mark_.push_back(0);
+      }
+      const int p = passengers_.size();
+      passengers_.push_back({id, pc, g, !group});
+      groups_[g].push_back(p);
+      who_[id] = p;
+      if (group)
+	movable_.push_back(p);
+      shift_moment(id, 1);
+    }
+
+    void LocalSearch::shift_moment(int id, int sign) {
+      if (!policy_.balance)
+	return;
+      std::array<int64_t, 2>& m = moment_[cabin_[id]];
+      m[0] += sign * (seats_.row(id) - seats_.cabins()[cabin_[id]].center);
+      m[1] += sign * seats_.lateral(id);
+    }
+
+    double LocalSearch::group_cost(int g) const {
+      const std::vector<int>& members = groups_[g];
+      double result = 0;
+      int lo = std::numeric_limits<int>::max(), hi = -1;
+      for (int p : members) {
+	const int id = passengers_[p].seat;
+	result += pen_[passengers_[p].pc][seats_.seat_class(id)] + cost_[id];
+	lo = std::min(lo, id);
+	hi = std::max(hi, id);
+	if (mode_ == NeighborMode::kSeats)
+	  seats_.each_neighbor(id, [this, g, &result](int j, Neighbor kind) {
+	      if (who_[j] >= 0 && passengers_[who_[j]].group != g)
+		result += policy_.neighbor(kind);
+	    });
+      }
+      result += policy_.non_contiguous * (hi - lo - static_cast<int>(members.size()) + 1);
+      if (mode_ == NeighborMode::kIds) {
+	// the seats just before and after the group, in its cabin
+	for (int id : {lo - 1, hi + 1})
+	  if (id >= 0 && id < seats_.size() && cabin_[id] == cabin_[lo] && who_[id] >= 0
+	      && passengers_[who_[id]].group != g)
+	    result += policy_.neighbor_seat_occupied;
+      }
+      return result;
+    }
+
+    double LocalSearch::balance_cost(int k) const {
+      if (!policy_.balance)
+	return 0;
+      return policy_.balance * (std::abs(moment_[k][0]) + std::abs(moment_[k][1]) / 2.0);
+    }
+
+    double LocalSearch::total() const {
+      double result = 0;
+      for (size_t g = 0; g < groups_.size(); ++g)
+	result += group_cost(g);
+      for (size_t k = 0; k < moment_.size(); ++k)
+	result += balance_cost(k);
+      return result;
+    }
+
+    void LocalSearch::touch(int id) {
+      auto note = [this](int j) {
+	if (who_[j] < 0)
+	  return;
+	const int g = passengers_[who_[j]].group;
+	if (mark_[g] != stamp_) {
+	  mark_[g] = stamp_;
+	  touched_.push_back(g);
+	}
+      };
+      note(id);
+      if (mode_ == NeighborMode::kIds) {
+	if (id > 0)
+	  note(id - 1);
+	if (id + 1 < seats_.size())
+	  note(id + 1);
+      }
+      else
+	seats_.each_neighbor(id, [this, &note](int j, Neighbor kind) {
+	    if (policy_.neighbor(kind))
+	      note(j);
+	  });
+    }
+
+    void LocalSearch::apply() {
+      for (const auto& m : moves_) {
+	const int id = passengers_[m.first].seat;
+	who_[id] = -1;
+	shift_moment(id, -1);
+      }
+      for (auto& m : moves_) {
+	int& id = passengers_[m.first].seat;
+	std::swap(id, m.second);
+	who_[id] = m.first;
+	shift_moment(id, 1);
+      }
+    }
+
+    bool LocalSearch::step(std::mt19937& rng) {
+      const int p = movable_[rng() % movable_.size()];
+      const Member& m = passengers_[p];
+      const int k = cabin_[m.seat];
+      const SeatMap::Cabin& c = seats_.cabins()[k];
+      const int first = c.first_seat, last = c.first_seat + c.seats();
+      const std::vector<int>& group = groups_[m.group];
+      moves_.clear();
+      if (group.size() > 1 && rng() % 4 == 0) {
+	// shift the whole group, keeping its shape, by a few seats
+	// or to anywhere in the cabin
+	int lo = last;
+	for (int q : group)
+	  lo = std::min(lo, passengers_[q].seat);
+	const int shift = rng() % 2 ? (1 + rng() % 3) * (rng() % 2 ? 1 : -1)
+	  : first + static_cast<int>(rng() % c.seats()) - lo;
+	if (!shift)
+	  return false;
+	for (int q : group) {
+	  const int to = passengers_[q].seat + shift;
+	  if (to < first || to >= last
+	      || (who_[to] >= 0 && passengers_[who_[to]].group != m.group))
+	    return false;
+	  moves_.emplace_back(q, to);
+	}
+      }
+      else {
+	// one passenger to another seat, swapping with its occupant
+	const int to = first + rng() % c.seats();
+	const int q = who_[to];
+	if (to == m.seat || (q >= 0 && passengers_[q].pinned))
+	  return false;
+	moves_.emplace_back(p, to);
+	if (q >= 0)
+	  moves_.emplace_back(q, m.seat);
+      }
+      // only the groups in and next to the seats that change pay
+      // differently
+      ++stamp_;
+      touched_.clear();
+      for (const auto& mv : moves_) {
+	touch(passengers_[mv.first].seat);
+	touch(mv.second);
+      }
+      double before = balance_cost(k);
+      for (int g : touched_)
+	before += group_cost(g);
+      apply();
+      double after = balance_cost(k);
+      for (int g : touched_)
+	after += group_cost(g);
+      if (after <= before)
+	return true;
+      apply();
+      return false;
+    }
+  } // namespace detail
+
+  void Flight::fill_search(detail::LocalSearch& search) const {
+    const size_t n = seats_->size();
+    for (size_t id = occupied_.next_set(0, n); id < n; id = occupied_.next_set(id + 1, n)) {
+      const unsigned h = occupants_[id].handle;
+      const SeatType type = use_arena_ ? arena_.type(h) : passengers_[h]->get_seat_type();
+      const bool minor = use_arena_ ? arena_.is_minor(h) : passengers_[h]->is_minor();
+      search.add(id, detail::passenger_class(type, minor), occupants_[id].group);
+    }
+  }
+
+  double Flight::total_penalty() const {
+    detail::LocalSearch search(*seats_, penalties_, neighbor_mode_);
+    fill_search(search);
+    return search.total();
+  }
+
+  Flight::ReoptimizeResult Flight::reoptimize(std::chrono::steady_clock::time_point deadline) {
+    detail::LocalSearch search(*seats_, penalties_, neighbor_mode_);
+    fill_search(search);
+    ReoptimizeResult result = {search.total(), 0, 0, 0};
+    std::mt19937 rng;
+    // reading the clock costs more than a step, so it is read
+    // every 64 of them
+    while (search.can_move()
+	   && (result.tried % 64 || std::chrono::steady_clock::now() < deadline)) {
+      result.kept += search.step(rng);
+      ++result.tried;
+    }
+    result.after = search.total();
+    // steps that cost nothing are kept, to get off plateaus, but
+    // nobody is moved for them alone
+    if (!(result.after < result.before)) {
+      result.after = result.before;
+      return result;
+    }
+    // passengers were added in id order; those who moved all leave
+    // their seats first, so that they can swap
+    struct Moved {
+      int from, to;
+      detail::OccupantTable::Entry occupant;
+    };
+    std::vector<Moved> moved;
+    const size_t n = seats_->size();
+    size_t p = 0;
+    for (size_t id = occupied_.next_set(0, n); id < n;
+	 id = occupied_.next_set(id + 1, n), ++p)
+      if (search.seat(p) != static_cast<int>(id))
+	moved.push_back({static_cast<int>(id), search.seat(p), occupants_[id]});
+    for (const Moved& m : moved)
+      vacate(m.from);
+    // each keeps its handle, and its group
+    for (const Moved& m : moved) {
+      occupants_[m.to].handle = m.occupant.handle;
+      mark_taken(m.to);
+      occupants_[m.to].group = m.occupant.group;
+    }
+    journal_commit();
+    return result;
+  }
+}
@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        VECTOR KERNELS
+
+#include <flight.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ASAP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace asap {
+  namespace detail {
+    namespace {
+      size_t first_min_scalar(const unsigned char* data, size_t n,
+			      const unsigned char* rank) {
+	size_t j = 0;
+	for (size_t i = 1; i < n; ++i)
+	  if (rank[data[i]] < rank[data[j]])
+	    j = i;
+	return n ? j : 0;
+      }
+
+#ifdef ASAP_X86
+      // Both vector versions make two passes: the lowest rank first,
+      // then the first position holding it, which usually is found
+      // early. The tail that does not fill a register is done in
+      // scalar code.
+
+      __attribute__((target("ssse3")))
+      size_t first_min_ssse3(const unsigned char* data, size_t n,
+			     const unsigned char* rank) {
+	const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rank));
+	const size_t m = n & ~size_t(15);
+	__m128i low = _mm_set1_epi8(-1);
+	for (size_t i = 0; i < m; i += 16) {
+	  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+	  low = _mm_min_epu8(low, _mm_shuffle_epi8(lut, v));
+	}
+	low = _mm_min_epu8(low, _mm_srli_si128(low, 8));
+	low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+	low = _mm_min_epu8(low, _mm_srli_si128(low, 2));
+	low = _mm_min_epu8(low, _mm_srli_si128(low, 1));
+	unsigned char best = _mm_cvtsi128_si32(low) & 0xff;
+	for (size_t i = m; i < n; ++i)
+	  best = std::min(best, rank[data[i]]);
+	const __m128i target = _mm_set1_epi8(best);
+	for (size_t i = 0; i < m; i += 16) {
+	  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+	  int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_shuffle_epi8(lut, v), target));
+	  if (mask)
+	    return i + __builtin_ctz(mask);
+	}
+	size_t i = m;
+	while (rank[data[i]] != best) ++i;
+	return i;
+      }
+
+      __attribute__((target("avx2")))
+      size_t first_min_avx2(const unsigned char* data, size_t n,
+			    const unsigned char* rank) {
+	const __m256i lut = _mm256_broadcastsi128_si256(
+	  _mm_loadu_si128(reinterpret_cast<const __m128i*>(rank)));
+	const size_t m = n & ~size_t(31);
+	__m256i low = _mm256_set1_epi8(-1);
+	for (size_t i = 0; i < m; i += 32) {
+	  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+	  low = _mm256_min_epu8(low, _mm256_shuffle_epi8(lut, v));
+	}
+	__m128i half = _mm_min_epu8(_mm256_castsi256_si128(low),
+				    _mm256_extracti128_si256(low, 1));
+	half = _mm_min_epu8(half, _mm_srli_si128(half, 8));
+	half = _mm_min_epu8(half, _mm_srli_si128(half, 4));
+	half = _mm_min_epu8(half, _mm_srli_si128(half, 2));
+	half = _mm_min_epu8(half, _mm_srli_si128(half, 1));
+	unsigned char best = _mm_cvtsi128_si32(half) & 0xff;
+	for (size_t i = m; i < n; ++i)
+	  best = std::min(best, rank[data[i]]);
+	const __m256i target = _mm256_set1_epi8(best);
+	for (size_t i = 0; i < m; i += 32) {
+	  __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+	  unsigned mask = _mm256_movemask_epi8(
+	    _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, v), target));
+	  if (mask)
+	    return i + __builtin_ctz(mask);
+	}
+	size_t i = m;
+	while (rank[data[i]] != best) ++i;
+	return i;
+      }
+#endif
+
+      typedef size_t (*kernel)(const unsigned char*, size_t, const unsigned char*);
+
+      kernel pick(Isa isa) {
+#ifdef ASAP_X86
+	switch (isa) {
+	case Isa::kAvx2: return first_min_avx2;
+	case Isa::kSsse3: return first_min_ssse3;
+	default: break;
+	}
+#endif
+	return first_min_scalar;
+      }
+    }
+
+    Isa detected_isa() {
+#ifdef ASAP_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+	return Isa::kAvx2;
+      if (__builtin_cpu_supports("ssse3"))
+	return Isa::kSsse3;
+#endif
+      return Isa::kScalar;
+    }
+
+    size_t first_min(const unsigned char* data, size_t n,
+		     const unsigned char* rank, Isa isa) {
+      // never more than the cpu has
+      static const Isa best = detected_isa();
+      if (!n)
+	return 0;
+      return pick(std::min(isa, best))(data, n, rank);
+    }
+
+    size_t first_min(const unsigned char* data, size_t n,
+		     const unsigned char* rank) {
+      static const kernel k = pick(detected_isa());
+      // short ranges are not worth the setup
+      if (n < 16)
+	return first_min_scalar(data, n, rank);
+      return k(data, n, rank);
+    }
+  }
+}
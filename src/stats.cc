@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////
+//
+// ASAP - Airtravel seat assigment program
+//        CHECK-IN STATISTICS
+
+#include <flight.hpp>
+#include <atomic>
+#include <cmath>
+
+namespace asap {
+  uint64_t LatencyHistogram::quantile(double q) const {
+    if (!count_)
+      return 0;
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count_));
+    uint64_t seen = 0;
+    int b = 0;
+    for (; b < n_buckets - 1 && (seen += buckets_[b]) < rank; ++b) { }
+    return std::min(b ? (uint64_t(1) << b) - 1 : 0, max_ns_);
+  }
+
+  LatencyHistogram& LatencyHistogram::operator+=(const LatencyHistogram& h) {
+    for (int b = 0; b < n_buckets; ++b)
+      buckets_[b] += h.buckets_[b];
+    count_ += h.count_;
+    total_ns_ += h.total_ns_;
+    max_ns_ = std::max(max_ns_, h.max_ns_);
+    return *this;
+  }
+
+  Stats::Counters& Stats::Counters::operator+=(const Counters& c) {
+    windows += c.windows;
+    penalties += c.penalties;
+    matches += c.matches;
+    overbooked += c.overbooked;
+    seat_unavailable += c.seat_unavailable;
+    return *this;
+  }
+
+  Stats::Counters Stats::Counters::operator-(const Counters& c) const {
+    Counters result;
+    result.windows = windows - c.windows;
+    result.penalties = penalties - c.penalties;
+    result.matches = matches - c.matches;
+    result.overbooked = overbooked - c.overbooked;
+    result.seat_unavailable = seat_unavailable - c.seat_unavailable;
+    return result;
+  }
+
+  Stats& Stats::operator+=(const Stats& s) {
+    counters += s.counters;
+    for (int op = 0; op < n_ops; ++op) {
+      ops[op] += s.ops[op];
+      latency[op] += s.latency[op];
+    }
+    return *this;
+  }
+
+  const char* Stats::name(Op op) {
+    static const char* names[n_ops] = {"load", "checkin_group", "checkin_passenger",
+				       "checkin_seat", "checkin_batch"};
+    return names[op];
+  }
+
+  // the counts of one thread, registered for as long as it runs.
+  // Only its thread writes them, by a plain load and store; they are
+  // atomic so that total() may read them meanwhile.
+  struct StatsRegistry::Slot {
+    typedef std::atomic<uint64_t> Count;
+    struct Latency {
+      std::array<Count, LatencyHistogram::n_buckets> buckets{};
+      Count count{}, total_ns{}, max_ns{};
+    };
+    Slot() {
+      StatsRegistry& r = instance();
+      std::lock_guard<std::mutex> l(r.lock_);
+      r.slots_.push_back(this);
+    }
+    ~Slot() {
+      StatsRegistry& r = instance();
+      std::lock_guard<std::mutex> l(r.lock_);
+      r.retired_ += read(*this);
+      r.slots_.erase(std::find(r.slots_.begin(), r.slots_.end(), this));
+    }
+    static void add(Count& c, uint64_t n) {
+      c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void clear(Count& c) { c.store(0, std::memory_order_relaxed); }
+    static uint64_t get(const Count& c) { return c.load(std::memory_order_relaxed); }
+    Count windows{}, penalties{}, matches{}, overbooked{}, seat_unavailable{};
+    std::array<Count, Stats::n_ops> ops{};
+    std::array<Latency, Stats::n_ops> latency;
+  };
+
+  Stats StatsRegistry::read(const Slot& s) {
+    Stats result;
+    result.counters.windows = Slot::get(s.windows);
+    result.counters.penalties = Slot::get(s.penalties);
+    result.counters.matches = Slot::get(s.matches);
+    result.counters.overbooked = Slot::get(s.overbooked);
+    result.counters.seat_unavailable = Slot::get(s.seat_unavailable);
+    for (int op = 0; op < Stats::n_ops; ++op) {
+      result.ops[op] = Slot::get(s.ops[op]);
+      LatencyHistogram& h = result.latency[op];
+      const Slot::Latency& l = s.latency[op];
+      for (int b = 0; b < LatencyHistogram::n_buckets; ++b)
+	h.buckets_[b] = Slot::get(l.buckets[b]);
+      h.count_ = Slot::get(l.count);
+      h.total_ns_ = Slot::get(l.total_ns);
+      h.max_ns_ = Slot::get(l.max_ns);
+    }
+    return result;
+  }
+
+  StatsRegistry& StatsRegistry::instance() {
+    // never destroyed, threads may still retire their slots at exit
+    static StatsRegistry* r = new StatsRegistry;
+    return *r;
+  }
+
+  void StatsRegistry::record(Stats::Op op, bool timed, uint64_t ns,
+			     const Stats::Counters& c) {
+    thread_local Slot slot;
+    Slot::add(slot.windows, c.windows);
+    Slot::add(slot.penalties, c.penalties);
+    Slot::add(slot.matches, c.matches);
+    Slot::add(slot.overbooked, c.overbooked);
+    Slot::add(slot.seat_unavailable, c.seat_unavailable);
+    Slot::add(slot.ops[op], 1);
+    if (!timed)
+      return;
+    Slot::Latency& l = slot.latency[op];
+    // bucket b holds [2^(b-1), 2^b), as in LatencyHistogram::add
+    Slot::add(l.buckets[std::min(ns ? 64 - __builtin_clzll(ns) : 0,
+				 LatencyHistogram::n_buckets - 1)], 1);
+    Slot::add(l.count, 1);
+    Slot::add(l.total_ns, ns);
+    if (ns > Slot::get(l.max_ns))
+      l.max_ns.store(ns, std::memory_order_relaxed);
+  }
+
+  Stats StatsRegistry::total() const {
+    std::lock_guard<std::mutex> l(lock_);
+    Stats result = retired_;
+    for (const Slot* s : slots_)
+      result += read(*s);
+    return result;
+  }
+
+  void StatsRegistry::reset() {
+    std::lock_guard<std::mutex> l(lock_);
+    retired_ = Stats();
+    for (Slot* s : slots_) {
+      for (Slot::Count* c : {&s->windows, &s->penalties, &s->matches, &s->overbooked,
+			     &s->seat_unavailable})
+	Slot::clear(*c);
+      for (Slot::Count& c : s->ops)
+	Slot::clear(c);
+      for (Slot::Latency& l : s->latency) {
+	for (Slot::Count& c : l.buckets)
+	  Slot::clear(c);
+	Slot::clear(l.count);
+	Slot::clear(l.total_ns);
+	Slot::clear(l.max_ns);
+      }
+    }
+  }
+}
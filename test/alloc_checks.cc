@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////
+//
+// Check-in must not allocate in steady state. Global operator new
+// is replaced by a counting version, and the number of allocations
+// during check-in is compared to what ownership requires.
+
+#include <flight.hpp>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+using namespace asap;
+
+static size_t n_allocs = 0;
+
+void* operator new(std::size_t n) {
+  ++n_allocs;
+  if (void* p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+const char* flight_file = "alloc_checks_flight.asc";
+
+void write_flight() {
+  std::ofstream out(flight_file);
+  out << "Flight ALLOC-1\n"
+      << "BUSINESS\nrows 4\nseats A B, C D\n"
+      << "ECONOMY\nrows 40\nseats A B C, D E F, G H I\nemergency 20\ncenter 25\n";
+}
+
+PassengerGroup make_group(int size) {
+  PassengerGroup g(TravelCategory::kEconomy);
+  const SeatType types[] = {SeatType::kWindow, SeatType::kAisle, SeatType::kOther};
+  for (int i = 0; i < size; ++i)
+    g.push("P" + std::to_string(i), types[i % 3], i % 4 == 0);
+  return g;
+}
+
+// group check-in allocates nothing once the scratch buffers are warm
+int check_group_checkin(AssignMode mode) {
+  int result = 0;
+  Flight f(flight_file);
+  f.set_assign_mode(mode);
+  PassengerGroup warm = make_group(12);
+  f.checkin(warm);
+  std::vector<PassengerGroup> groups;
+  for (int i = 0; i < 20; ++i)
+    groups.push_back(make_group(1 + i % 12));
+  size_t before = n_allocs;
+  for (auto& g : groups)
+    f.checkin(g);
+  size_t allocs = n_allocs - before;
+  if (allocs) {
+    std::cout << "Group check-in allocations -- ERROR" << std::endl
+	      << "  " << allocs << " allocations for " << groups.size()
+	      << " groups" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Group check-in allocations -- OK" << std::endl;
+  return result;
+}
+
+// a single check-in only allocates the passenger
+int check_single_checkin() {
+  int result = 0;
+  Flight f(flight_file);
+  PassengerGroup warm = make_group(12);
+  f.checkin(warm);
+  size_t before = n_allocs;
+  for (int i = 0; i < 20; ++i)
+    f.checkin(TravelCategory::kEconomy, "Boone", SeatType::kWindow);
+  size_t allocs = n_allocs - before;
+  if (allocs != 20) {
+    std::cout << "Single check-in allocations -- ERROR" << std::endl
+	      << "  " << allocs << " allocations for 20 passengers" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Single check-in allocations -- OK" << std::endl;
+  return result;
+}
+
+// claiming a seat by label only allocates the passenger
+int check_seat_checkin() {
+  int result = 0;
+  Flight f(flight_file);
+  const char* labels[] = {"5A", "5B", "5C", "5D", "5E", "5F", "5G", "5H", "5I",
+			  "44A", "44B", "44C", "44D", "44E", "44F", "44G", "44H",
+			  "44I", "30E", "31E"};
+  size_t before = n_allocs;
+  for (auto label : labels)
+    if (f.checkin(TravelCategory::kEconomy, "Ben", false, label)
+	!= Flight::AssignResult::kOk)
+      ++result;
+  size_t allocs = n_allocs - before;
+  if (result || allocs != 20) {
+    std::cout << "Seat check-in allocations -- ERROR" << std::endl
+	      << "  " << allocs << " allocations for 20 passengers" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Seat check-in allocations -- OK" << std::endl;
+  return result;
+}
+
+// with an arena, passengers are not allocated one by one either
+int check_arena_checkin() {
+  int result = 0;
+  Flight f(flight_file);
+  f.set_arena(true);
+  PassengerGroup warm = make_group(12);
+  f.checkin(warm);
+  f.checkin(TravelCategory::kEconomy, "Boone", SeatType::kWindow);
+  f.checkin(TravelCategory::kEconomy, "Ben", false, "44I");
+  size_t before = n_allocs;
+  for (int i = 0; i < 20; ++i)
+    f.checkin(TravelCategory::kEconomy, "Boone", SeatType::kWindow);
+  const char* labels[] = {"5A", "5B", "5C", "5D", "5E", "5F", "5G", "5H", "5I", "30E"};
+  for (auto label : labels)
+    if (f.checkin(TravelCategory::kEconomy, "Ben", false, label)
+	!= Flight::AssignResult::kOk)
+      ++result;
+  size_t allocs = n_allocs - before;
+  if (result || allocs) {
+    std::cout << "Arena check-in allocations -- ERROR" << std::endl
+	      << "  " << allocs << " allocations for 30 passengers" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Arena check-in allocations -- OK" << std::endl;
+  return result;
+}
+
+// a flight loaded from an image allocates the same, whatever the
+// no. of seats
+int check_image_load() {
+  int result = 0;
+  size_t allocs[2];
+  for (int k = 0; k < 2; ++k) {
+    {
+      std::ofstream out("alloc_checks_flight.asc");
+      out << "Flight IMAGE-1\nECONOMY\nrows " << 40 * (k + 1)
+	  << "\nseats A B C, D E F, G H I\nemergency 20\ncenter 25\n";
+    }
+    Flight::compile("alloc_checks_flight.asc", "alloc_checks_flight.img");
+    size_t before = n_allocs;
+    {
+      Flight f("alloc_checks_flight.img");
+    }
+    allocs[k] = n_allocs - before;
+  }
+  write_flight();
+  if (allocs[0] != allocs[1]) {
+    std::cout << "Image load allocations -- ERROR" << std::endl
+	      << "  " << allocs[0] << " allocations for 360 seats, "
+	      << allocs[1] << " for 720" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Image load allocations -- OK" << std::endl;
+  return result;
+}
+
+// a flight on a shared layout allocates the same, whatever the
+// no. of seats
+int check_layout_flight() {
+  int result = 0;
+  size_t allocs[2];
+  for (int k = 0; k < 2; ++k) {
+    {
+      std::ofstream out("alloc_checks_flight.asc");
+      out << "Flight LAYOUT-1\nECONOMY\nrows " << 40 * (k + 1)
+	  << "\nseats A B C, D E F, G H I\nemergency 20\ncenter 25\n";
+    }
+    auto layout = AircraftLayout::load("alloc_checks_flight.asc");
+    size_t before = n_allocs;
+    {
+      Flight f(layout);
+    }
+    allocs[k] = n_allocs - before;
+  }
+  write_flight();
+  if (allocs[0] != allocs[1]) {
+    std::cout << "Layout flight allocations -- ERROR" << std::endl
+	      << "  " << allocs[0] << " allocations for 360 seats, "
+	      << allocs[1] << " for 720" << std::endl;
+    ++result;
+  }
+  else
+    std::cout << "Layout flight allocations -- OK" << std::endl;
+  return result;
+}
+
+// rendering allocates nothing per seat, once the output string has
+// grown, and for a stream nothing at all
+int check_render() {
+  int result = 0;
+  for (bool arena : {false, true}) {
+    Flight f(flight_file);
+    f.set_arena(arena);
+    PassengerGroup g = make_group(12);
+    f.checkin(g);
+    std::string out;
+    std::ostringstream stream;
+    for (RenderFormat format : {RenderFormat::kText, RenderFormat::kJson, RenderFormat::kCsv}) {
+      f.render(out, format);
+      f.render(stream, format);
+      size_t before = n_allocs;
+      out.clear();
+      f.render(out, format);
+      size_t allocs = n_allocs - before;
+      // the stream has grown in the warm-up as well
+      stream.seekp(0);
+      before = n_allocs;
+      f.render(stream, format);
+      allocs += n_allocs - before;
+      if (allocs) {
+	std::cout << "Render allocations -- ERROR" << std::endl
+		  << "  " << allocs << " allocations for format "
+		  << static_cast<int>(format) << std::endl;
+	++result;
+      }
+    }
+  }
+  if (!result)
+    std::cout << "Render allocations -- OK" << std::endl;
+  return result;
+}
+
+int main() {
+  write_flight();
+  int result = check_group_checkin(AssignMode::kGreedy)
+    + check_group_checkin(AssignMode::kOptimal) + check_single_checkin()
+    + check_seat_checkin() + check_arena_checkin() + check_image_load()
+    + check_render() + check_layout_flight();
+  std::cout << result << " tests failed" << std::endl;
+  return result;
+}
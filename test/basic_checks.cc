@@ -7,10 +7,21 @@
 // \author Dirk Hesse <herr.dirk.hesse@gmail.com>
 // \date Mon Oct  6 10:25:33 2013
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <flight.hpp>
+#include <engine.hpp>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <memory>
+#include <random>
+#include <sstream>
+#include <cstdio>
+#include <thread>
+#include <utility>
 
 using namespace asap;
 
@@ -36,8 +47,8 @@ struct TestHelper {
 int check_penalties() {
   int result = 0;
   TestHelper helper;
-  const double& s = detail::wrong_seat_penalty;
-  const double& e = detail::wrong_sec_penalty;
+  const double& s = detail::DefaultPenalties::wrong_seat;
+  const double& e = detail::DefaultPenalties::wrong_sec;
   std::vector<double> known = 
     {e, 0, e + s, s, e + s, s,
      0, 0, s, s, s, s,
@@ -125,8 +136,1606 @@ int check_assign() {
   return result;
 }
 
+// the window Flight::checkin used to pick, calling match() for
+// every window
+size_t reference_window(PassengerGroup& g,
+			const std::vector<std::shared_ptr<Seat> >& empty_seats) {
+  auto first = empty_seats.begin();
+  auto last = empty_seats.begin() + std::min(g.size(), empty_seats.size());
+  size_t best = 0;
+  std::deque<std::shared_ptr<Seat> > current(first, last);
+  double best_score = detail::match(g.begin(), g.end(), current.begin(), current.end());
+  while (last != empty_seats.end()){
+    current.assign(++first, ++last);
+    double new_score = detail::match(g.begin(), g.end(), current.begin(), current.end());
+    if ((last+1) != empty_seats.end() && last != empty_seats.end())
+      if ((*(last+1))->get_id() - 1 != (*last)->get_id())
+	new_score += detail::DefaultPenalties::neighbor_seat_occupied;
+    if (first != empty_seats.begin())
+      if ((*(first-1))->get_id() + 1 != (*first)->get_id())
+	new_score += detail::DefaultPenalties::neighbor_seat_occupied;
+    if (new_score < best_score){
+      best = first - empty_seats.begin();
+      best_score = new_score;
+    }
+  }
+  return best;
+}
+
+// the window scorer has to agree with match() on random cabins
+int check_window_scorer() {
+  int result = 0;
+  std::string err_string;
+  std::mt19937 rng(42);
+  TestHelper helper;
+  for (int trial = 0; trial < 2000; ++trial) {
+    std::vector<std::shared_ptr<Seat> > seats;
+    int id = 0;
+    int n = 1 + rng() % 40;
+    for (int i = 0; i < n; ++i) {
+      id += 1 + (rng() % 4 == 0) * (rng() % 3); // some gaps
+      seats.push_back(std::make_shared<Seat>(helper.seat_types[rng() % 3], id, "",
+					     rng() % 6, rng() % 5 == 0));
+    }
+    PassengerGroup g(TravelCategory::kEconomy);
+    int size = 1 + rng() % 8;
+    for (int i = 0; i < size; ++i)
+      g.push("", helper.seat_types[rng() % 3], rng() % 3 == 0);
+    g.sort();
+    detail::WindowScorer scorer;
+    for (auto s : seats)
+      scorer.push_back(detail::seat_class(s->get_seat_type(),
+					  s->is_emergency_exit_seat()),
+		       s->get_id(), s->get_intrinsic_cost());
+    scorer.set_group(g.begin(), g.end());
+    for (size_t o = 0; o + scorer.window() <= seats.size(); ++o) {
+      std::deque<std::shared_ptr<Seat> > window(seats.begin() + o,
+						seats.begin() + o + scorer.window());
+      if (scorer.score(o) != detail::match(g.begin(), g.end(), window.begin(), window.end())) {
+	err_string += "  wrong score in trial " + std::to_string(trial) + "\n";
+	++result;
+	break;
+      }
+    }
+    if (scorer.best_window() != reference_window(g, seats)) {
+      err_string += "  wrong window in trial " + std::to_string(trial) + "\n";
+      ++result;
+    }
+    // parallel scoring picks the same window, ties included
+    for (auto mode : {AssignMode::kGreedy, AssignMode::kOptimal}) {
+      scorer.set_mode(mode);
+      scorer.set_parallel(1);
+      size_t serial = scorer.best_window();
+      scorer.set_parallel(3, 1);
+      if (scorer.best_window() != serial) {
+	err_string += "  parallel window differs in trial " + std::to_string(trial) + "\n";
+	++result;
+      }
+    }
+  }
+  // scorers on several threads share the slice pool
+  {
+    std::vector<detail::WindowScorer> scorers(4);
+    std::vector<size_t> serial(scorers.size());
+    PassengerGroup g(TravelCategory::kEconomy);
+    for (int i = 0; i < 3; ++i)
+      g.push("", helper.seat_types[i], false);
+    g.sort();
+    for (size_t k = 0; k < scorers.size(); ++k) {
+      for (int id = 0; id < 3000; ++id)
+	scorers[k].push_back(rng() % detail::n_seat_classes, id, rng() % 40);
+      scorers[k].set_group(g.begin(), g.end());
+      serial[k] = scorers[k].best_window();
+      scorers[k].set_parallel(3, 1);
+    }
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < scorers.size(); ++k)
+      threads.emplace_back([&, k]() {
+	  for (int i = 0; i < 50; ++i)
+	    wrong += scorers[k].best_window() != serial[k];
+	});
+    for (auto& t : threads)
+      t.join();
+    if (wrong) {
+      err_string += "  parallel window differs on shared pool\n";
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Window scorer -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Window scorer -- OK" << std::endl;
+  return result;
+}
+
+// all kernel versions agree with std::min_element on the penalties
+int check_first_min() {
+  int result = 0;
+  std::string err_string;
+  std::mt19937 rng(3);
+  for (int trial = 0; trial < 3000; ++trial) {
+    unsigned char rank[16];
+    double pen[16];
+    for (int c = 0; c < 16; ++c) {
+      rank[c] = rng() % 4;
+      pen[c] = rank[c] * 0.5;
+    }
+    std::vector<unsigned char> data(rng() % 100);
+    for (auto& d : data)
+      d = rng() % (trial % 2 ? 6 : 16);
+    size_t expected = std::min_element(data.begin(), data.end(),
+				       [&](unsigned char a, unsigned char b) {
+					 return pen[a] < pen[b];
+				       }) - data.begin();
+    for (auto isa : {detail::Isa::kScalar, detail::Isa::kSsse3, detail::Isa::kAvx2})
+      if (detail::first_min(data.data(), data.size(), rank, isa) != expected) {
+	err_string += "  wrong index in trial " + std::to_string(trial) + "\n";
+	++result;
+      }
+    if (detail::first_min(data.data(), data.size(), rank) != expected) {
+      err_string += "  wrong index in trial " + std::to_string(trial) + "\n";
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Argmin kernel -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Argmin kernel -- OK" << std::endl;
+  return result;
+}
+
+// the optimal mode has to find the best assignment, brute force on
+// small groups
+int check_optimal_assign() {
+  int result = 0;
+  std::string err_string;
+  std::mt19937 rng(7);
+  TestHelper helper;
+  for (int trial = 0; trial < 500; ++trial) {
+    int size = 1 + rng() % 6;
+    std::vector<std::shared_ptr<Seat> > seats;
+    for (int i = 0; i < size; ++i)
+      seats.push_back(std::make_shared<Seat>(helper.seat_types[rng() % 3], i, "",
+					     0, rng() % 4 == 0));
+    PassengerGroup g(TravelCategory::kEconomy);
+    for (int i = 0; i < size; ++i)
+      g.push("", helper.seat_types[rng() % 3], rng() % 3 == 0);
+    g.sort();
+    std::vector<int> perm(size);
+    for (int i = 0; i < size; ++i) perm[i] = i;
+    double best = std::numeric_limits<double>::max();
+    do {
+      double pen = 0;
+      for (int i = 0; i < size; ++i)
+	pen += detail::penalty(seats[perm[i]], *(g.begin() + i));
+      best = std::min(best, pen);
+    } while (std::next_permutation(perm.begin(), perm.end()));
+    detail::WindowScorer scorer;
+    for (auto s : seats)
+      scorer.push_back(detail::seat_class(s->get_seat_type(),
+					  s->is_emergency_exit_seat()),
+		       s->get_id(), s->get_intrinsic_cost());
+    scorer.set_group(g.begin(), g.end());
+    scorer.set_mode(AssignMode::kOptimal);
+    detail::TransportPlan plan;
+    scorer.plan(0, plan);
+    std::deque<std::shared_ptr<Seat> > window(seats.begin(), seats.end());
+    detail::assign(g.begin(), g.end(), window.begin(), window.end(), plan);
+    double assigned = 0;
+    for (auto s : seats)
+      if (s->get_passenger())
+	assigned += detail::penalty(s, s->get_passenger());
+      else
+	assigned += 1000;
+    if (plan.cost != best || assigned != best) {
+      err_string += "  not optimal in trial " + std::to_string(trial) + "\n";
+      ++result;
+    }
+  }
+  // a minor without preference should not take the only window seat
+  std::deque<std::shared_ptr<Seat> > seats =
+    {std::make_shared<Seat>(SeatType::kWindow, 0),
+     std::make_shared<Seat>(SeatType::kAisle, 1)};
+  PassengerGroup g(TravelCategory::kEconomy);
+  g.push("Kid", SeatType::kOther, true);
+  g.push("Mum", SeatType::kWindow, false);
+  g.sort();
+  detail::WindowScorer scorer;
+  for (auto s : seats)
+    scorer.push_back(detail::seat_class(s->get_seat_type(), false),
+		     s->get_id(), 0);
+  scorer.set_group(g.begin(), g.end());
+  scorer.set_mode(AssignMode::kOptimal);
+  if (scorer.score(0) != 0) {
+    err_string += "  window preference not met\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Optimal assign -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Optimal assign -- OK" << std::endl;
+  return result;
+}
+
+const char* sample_flight =
+  "Flight OCEANIC-815\n\n"
+  "FIRST\nrows 2\nseats A,B\n\n"
+  "BUSINESS\nrows 3\nseats A B,C D\n\n"
+  "ECONOMY\nrows 10\nseats A B C, D E F\nemergency 10\ncenter 11\n";
+
+// write a flight file, return its name
+std::string write_flight(const std::string& name, const std::string& contents) {
+  std::ofstream out(name);
+  out << contents;
+  return name;
+}
+
+// show() output of a flight
+std::string show(Flight& f) {
+  std::ostringstream out;
+  std::streambuf* old = std::cout.rdbuf(out.rdbuf());
+  f.show();
+  std::cout.rdbuf(old);
+  return out.str();
+}
+
+// seat labels, types and exits of the flat seat map
+int check_seat_map() {
+  int result = 0;
+  std::string err_string;
+  Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+  if (f.n_seats() != 2*2 + 3*4 + 10*6) {
+    err_string += "  wrong number of seats\n";
+    ++result;
+  }
+  // first row of a cabin runs right-to-left, the next one
+  // left-to-right
+  std::vector<std::string> info = {"1B(W)", "1A(W)", "2A(W)", "2B(W)", "3D(W)",
+				   "3C(A)", "3B(A)", "3A(W)", "4A(W)"};
+  for (size_t id = 0; id < info.size(); ++id)
+    if (f.seat(id).get_info() != info[id]) {
+      err_string += "  seat " + std::to_string(id) + " is " + f.seat(id).get_info()
+	+ ", expected " + info[id] + "\n";
+      ++result;
+    }
+  Seat s = f.seat(2*2 + 3*4 + 6*9); // first seat in row 15
+  if (s.get_desc() != "15A" || s.get_intrinsic_cost() != 4
+      || s.is_emergency_exit_seat() || s.get_passenger()) {
+    err_string += "  wrong properties for " + s.get_desc() + "\n";
+    ++result;
+  }
+  s = f.seat(2*2 + 3*4 + 6*4 + 1); // in row 10
+  if (s.get_info() != "10E(E)" || s.get_intrinsic_cost() != 1) {
+    err_string += "  wrong properties for " + s.get_desc() + "\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Seat map -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Seat map -- OK" << std::endl;
+  return result;
+}
+
+// seat labels are found, taken seats are not handed out twice
+int check_seat_labels() {
+  int result = 0;
+  std::string err_string;
+  Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+  for (int id = 0; id < f.n_seats(); ++id) {
+    const std::string label = f.seat(id).get_desc();
+    const TravelCategory cat = id < 4 ? TravelCategory::kFirst
+      : id < 16 ? TravelCategory::kBusiness : TravelCategory::kEconomy;
+    if (f.checkin(cat, label, false, label) != Flight::AssignResult::kOk
+	|| f.seat(id).get_passenger()->get_name() != label) {
+      err_string += "  could not claim " + label + "\n";
+      ++result;
+    }
+  }
+  // all seats taken now
+  if (f.checkin(TravelCategory::kEconomy, "Boone", SeatType::kWindow)
+      != Flight::AssignResult::kOverbooked) {
+    err_string += "  full flight not overbooked\n";
+    ++result;
+  }
+  Flight g(write_flight("basic_checks_flight.asc", sample_flight));
+  std::streambuf* old = std::cerr.rdbuf(0); // silence complaints
+  std::vector<std::string> bad = {"", "A", "0A", "6", "16A", "6G", "6AA", "A6",
+				  "1A", "99999999999A"};
+  for (auto label : bad)
+    if (g.checkin(TravelCategory::kEconomy, "Ben", false, label)
+	!= Flight::AssignResult::kSeatUnavailable) {
+      err_string += "  found seat '" + label + "'\n";
+      ++result;
+    }
+  g.checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+  if (g.checkin(TravelCategory::kEconomy, "Boone", false, "6A")
+      != Flight::AssignResult::kSeatUnavailable) {
+    err_string += "  seat handed out twice\n";
+    ++result;
+  }
+  std::cerr.rdbuf(old);
+  // ids out of range are rejected, not looked up
+  for (int id : {-1, g.n_seats()}) {
+    int thrown = 0;
+    try { g.seat(id); } catch (const std::out_of_range&) { ++thrown; }
+    try { g.category(id); } catch (const std::out_of_range&) { ++thrown; }
+    try { g.seat_label(id); } catch (const std::out_of_range&) { ++thrown; }
+    try { g.occupied_neighbors(id, Neighbor::kSameRow); }
+    catch (const std::out_of_range&) { ++thrown; }
+    if (thrown != 4) {
+      err_string += "  seat id " + std::to_string(id) + " accepted\n";
+      ++result;
+    }
+  }
+  // fill the rest of the cabin, 6A must stay Ben's
+  PassengerGroup group(TravelCategory::kEconomy);
+  for (int i = 0; i < 59; ++i)
+    group.push("P", SeatType::kWindow, false);
+  if (g.checkin(group) != Flight::AssignResult::kOk
+      || g.seat(16 + 5).get_passenger()->get_name() != "Ben") {
+    err_string += "  claimed seat reassigned\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Seat labels -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Seat labels -- OK" << std::endl;
+  return result;
+}
+
+// dropping seats from the scorer is the same as leaving them out
+int check_scorer_erase() {
+  int result = 0;
+  std::mt19937 rng(3);
+  for (int trial = 0; trial < 200; ++trial) {
+    std::vector<int> classes, costs;
+    int n = 10 + rng() % 30;
+    for (int i = 0; i < n; ++i) {
+      classes.push_back(rng() % detail::n_seat_classes);
+      costs.push_back(rng() % 5);
+    }
+    PassengerGroup g(TravelCategory::kEconomy);
+    for (int i = 0; i < 4; ++i)
+      g.push("", static_cast<SeatType>(rng() % 3), rng() % 3 == 0);
+    g.sort();
+    size_t offset = rng() % (n - 5), count = 1 + rng() % 5;
+    detail::WindowScorer erased, marked, fresh;
+    for (int i = 0; i < n; ++i) {
+      erased.push_back(classes[i], 2*i, costs[i]);
+      marked.push_back(classes[i], 2*i, costs[i]);
+      if (i < static_cast<int>(offset) || i >= static_cast<int>(offset + count))
+	fresh.push_back(classes[i], 2*i, costs[i]);
+    }
+    erased.erase(offset, count);
+    erased.set_group(g.begin(), g.end());
+    fresh.set_group(g.begin(), g.end());
+    for (size_t o = 0; o + fresh.window() <= fresh.size(); ++o)
+      if (erased.score(o) != fresh.score(o) || erased.id(o) != fresh.id(o))
+	++result;
+    // marked seats are skipped, and dropped by compact()
+    marked.take(offset, count);
+    marked.set_group(g.begin(), g.end());
+    size_t best = marked.best_window();
+    if (best < marked.size() && best < offset + count && best + marked.window() > offset)
+      ++result;
+    marked.compact();
+    marked.set_group(g.begin(), g.end());
+    if (marked.size() != fresh.size())
+      ++result;
+    else
+      for (size_t o = 0; o + fresh.window() <= fresh.size(); ++o)
+	if (marked.score(o) != fresh.score(o) || marked.id(o) != fresh.id(o))
+	  ++result;
+  }
+  if (result)
+    std::cout << "Scorer erase -- ERROR" << std::endl;
+  else
+    std::cout <<  "Scorer erase -- OK" << std::endl;
+  return result;
+}
+
+// a batch seats everybody exactly once and reports overbooking
+int check_batch() {
+  int result = 0;
+  std::string err_string;
+  Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+  std::vector<PassengerGroup> groups;
+  std::mt19937 rng(11);
+  int total = 0;
+  for (int i = 0; i < 25; ++i) {
+    groups.push_back(PassengerGroup(TravelCategory::kEconomy));
+    int size = 1 + rng() % 4;
+    for (int j = 0; j < size && total < 60; ++j, ++total)
+      groups.back().push(std::to_string(total), static_cast<SeatType>(rng() % 3),
+			 rng() % 4 == 0);
+  }
+  groups.push_back(PassengerGroup(TravelCategory::kBusiness));
+  groups.back().push("John", SeatType::kWindow, false);
+  auto results = f.checkin_batch(groups);
+  std::vector<int> seated(total, 0);
+  for (int id = 0; id < f.n_seats(); ++id)
+    if (auto p = f.seat(id).get_passenger())
+      if (p->get_name() != "John")
+	++seated[std::stoi(p->get_name())];
+  if (std::count(seated.begin(), seated.end(), 1) != total) {
+    err_string += "  not everybody seated once\n";
+    ++result;
+  }
+  if (std::count(results.begin(), results.end(), Flight::AssignResult::kOk)
+      != static_cast<int>(groups.size())) {
+    err_string += "  unexpected failure\n";
+    ++result;
+  }
+  // economy is full now
+  std::vector<PassengerGroup> more(1, PassengerGroup(TravelCategory::kEconomy));
+  more[0].push("Boone", SeatType::kWindow, false);
+  if (total == 60 && f.checkin_batch(more)[0] != Flight::AssignResult::kOverbooked) {
+    err_string += "  overbooking not reported\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Batch check-in -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Batch check-in -- OK" << std::endl;
+  return result;
+}
+
+// flights run by the engine end up as if checked in one by one
+int check_engine() {
+  int result = 0;
+  std::string err_string;
+  std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  const int n_flights = 6;
+  std::vector<std::unique_ptr<Flight> > serial;
+  std::vector<std::vector<Flight::AssignResult> > expected(n_flights), got(n_flights);
+  std::vector<std::vector<std::future<Flight::AssignResult> > > futures(n_flights);
+  {
+    CheckinEngine engine(3);
+    for (int i = 0; i < n_flights; ++i) {
+      serial.emplace_back(new Flight(file));
+      engine.add_flight(file);
+    }
+    std::mt19937 rng(5);
+    for (int k = 0; k < 40; ++k) {
+      int i = rng() % n_flights;
+      TravelCategory cat = rng() % 5 ? TravelCategory::kEconomy : TravelCategory::kBusiness;
+      std::string name = std::to_string(k);
+      if (rng() % 4 == 0) {
+	std::string seat_no = std::to_string(1 + rng() % 20) + "ABCDEFG"[rng() % 7];
+	expected[i].push_back(serial[i]->checkin(cat, name, false, seat_no));
+	futures[i].push_back(engine.checkin(i, cat, name, false, seat_no));
+	continue;
+      }
+      PassengerGroup g(cat);
+      int size = 1 + rng() % 4;
+      for (int j = 0; j < size; ++j)
+	g.push(name + "/" + std::to_string(j), static_cast<SeatType>(rng() % 3),
+	       rng() % 4 == 0);
+      futures[i].push_back(engine.checkin(i, g));
+      expected[i].push_back(serial[i]->checkin(g));
+    }
+    for (int i = 0; i < n_flights; ++i)
+      for (auto& f : futures[i])
+	got[i].push_back(f.get());
+    engine.wait();
+    for (int i = 0; i < n_flights; ++i)
+      if (engine.submit(i, [](Flight& f) { return show(f); }).get() != show(*serial[i])) {
+	err_string += "  seating differs\n";
+	++result;
+      }
+  }
+  if (got != expected) {
+    err_string += "  results differ\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Check-in engine -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Check-in engine -- OK" << std::endl;
+  return result;
+}
+
+// asynchronous check-ins, batched or one by one
+int check_async_engine() {
+  int result = 0;
+  std::string err_string;
+  std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  auto group = [](int k, int size) {
+    PassengerGroup g(k % 5 ? TravelCategory::kEconomy : TravelCategory::kBusiness);
+    for (int j = 0; j < size; ++j)
+      g.push(std::to_string(k) + "/" + std::to_string(j), static_cast<SeatType>((k + j) % 3),
+	     (k + j) % 4 == 0);
+    return g;
+  };
+  // without batching, as if checked in one by one
+  {
+    CheckinEngine engine(2);
+    engine.set_max_batch(1);
+    engine.add_flight(file);
+    Flight serial(file);
+    std::vector<std::future<CheckinEngine::Reply> > replies;
+    std::vector<std::pair<Flight::AssignResult, std::string> > expected;
+    for (int k = 0; k < 20; ++k) {
+      replies.push_back(engine.checkin_async(0, group(k, 1 + k % 4)));
+      PassengerGroup g = group(k, 1 + k % 4);
+      expected.emplace_back(serial.checkin(g), "");
+      for (int id : serial.last_seats())
+	expected.back().second += (id < 0 ? "-" : serial.seat_label(id)) + " ";
+    }
+    for (size_t k = 0; k < replies.size(); ++k) {
+      CheckinEngine::Reply r = replies[k].get();
+      std::string seats;
+      for (int id : r.seats)
+	seats += (id < 0 ? "-" : engine.seat_label(0, id)) + " ";
+      if (r.result != expected[k].first || seats != expected[k].second) {
+	err_string += "  reply " + std::to_string(k) + " is " + seats + "\n";
+	++result;
+      }
+    }
+    if (engine.submit(0, [](Flight& f) { return show(f); }).get() != show(serial)) {
+      err_string += "  seating differs\n";
+      ++result;
+    }
+  }
+  // many producers, batched: everybody ends up where the reply says
+  {
+    CheckinEngine engine(2);
+    engine.add_flight(file);
+    engine.add_flight(file);
+    std::mutex mutex;
+    std::vector<CheckinEngine::Reply> replies[2];
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 8; ++t)
+      producers.emplace_back([&, t]() {
+	  for (int k = t * 10; k < t * 10 + 10; ++k) {
+	    const int i = k % 2;
+	    engine.checkin_async(i, group(k, 1 + k % 3), [&, i](CheckinEngine::Reply r) {
+		std::lock_guard<std::mutex> lock(mutex);
+		replies[i].push_back(std::move(r));
+	      });
+	  }
+	});
+    for (auto& t : producers)
+      t.join();
+    engine.wait();
+    for (int i = 0; i < 2; ++i) {
+      const std::map<std::string, std::string> seated =
+	engine.submit(i, [](Flight& f) {
+	    std::map<std::string, std::string> names; // by seat
+	    for (int id = 0; id < f.n_seats(); ++id)
+	      if (auto p = f.seat(id).get_passenger())
+		names[f.seat_label(id)] = p->get_name();
+	    return names;
+	  }).get();
+      size_t n = 0;
+      for (const auto& r : replies[i]) {
+	auto seat = r.seats.begin();
+	for (const auto& p : r.group) {
+	  const int id = *seat++;
+	  n += id >= 0 && seated.at(engine.seat_label(i, id)) == p->get_name();
+	}
+      }
+      if (replies[i].size() != 40 || n != seated.size()) {
+	err_string += "  wrong replies for flight " + std::to_string(i) + "\n";
+	++result;
+      }
+    }
+  }
+  if (result)
+    std::cout << "Asynchronous check-in -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Asynchronous check-in -- OK" << std::endl;
+  return result;
+}
+
+// a compile-time policy without the exit row term
+struct NoExitRule : detail::DefaultPenalties {
+  static constexpr double wrong_sec = 0;
+};
+
+// penalty weights from the flight file, and policy types
+int check_penalty_policy() {
+  int result = 0;
+  std::string err_string;
+  TestHelper helper;
+  detail::PenaltyWeights w;
+  w.set("wrong_sec", 0);
+  for (auto p : helper.all_passengers)
+    for (auto s : helper.all_seats)
+      if (detail::penalty(s, p, NoExitRule()) != detail::penalty(s, p, w)
+	  || detail::penalty(s, p, detail::PenaltyWeights())
+	  != detail::penalty(s, p)) {
+	err_string += "  policies disagree\n";
+	++result;
+      }
+  if (!detail::PenaltyWeights().is_default() || w.is_default() || w.set("nope", 1)) {
+    err_string += "  weights not set right\n";
+    ++result;
+  }
+  // the default weights, spelled out, seat like the sample
+  std::string file = std::string(sample_flight) + "penalty wrong_seat 1\npenalty wrong_sec 100\n"
+    "penalty neighbor_seat_occupied 20\npenalty weight 1\npenalty non_contiguous 1\n";
+  Flight f(write_flight("basic_checks_flight.asc", file));
+  Flight g(write_flight("basic_checks_flight.asc", sample_flight));
+  if (!f.get_penalties().is_default()) {
+    err_string += "  weights not read\n";
+    ++result;
+  }
+  // no weight on the distance to the center: first seats first
+  Flight h(write_flight("basic_checks_flight.asc",
+			std::string(sample_flight) + "penalty weight 0\npenalty neighbor_seat_occupied 0\n"));
+  for (Flight* x : {&f, &g, &h}) {
+    PassengerGroup a(TravelCategory::kEconomy);
+    a.push("Kate", SeatType::kOther, false);
+    a.push("Jack", SeatType::kOther, false);
+    x->checkin(a);
+  }
+  if (show(f) != show(g) || show(h) == show(g)
+      || !h.seat(h.n_seats() - 60).get_passenger()) {
+    err_string += "  wrong seating\n";
+    ++result;
+  }
+  try {
+    Flight bad(write_flight("basic_checks_flight.asc",
+				std::string(sample_flight) + "penalty nope 1\n"));
+    err_string += "  unknown weight accepted\n";
+    ++result;
+  }
+  catch (Flight::InputFileFormatError&) { }
+  if (result)
+    std::cout << "Penalty policy -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Penalty policy -- OK" << std::endl;
+  return result;
+}
+
+// the flight file parser, layouts and error positions
+int check_layout_parser() {
+  int result = 0;
+  std::string err_string;
+  detail::Layout l;
+  detail::parse_layout("flight X-1\neconomy\nROWS 3 Seats A B_1, C\tD,E;\n"
+		       "Emergency 2 bogus words\nFirst rows 1\nseats A", l);
+  const std::vector<std::string> labels = {"A", "B_1", "C", "D", "E"};
+  const std::vector<SeatType> types = {SeatType::kWindow, SeatType::kAisle,
+				       SeatType::kAisle, SeatType::kAisle, SeatType::kWindow};
+  if (l.flight_number != "X-1" || l.cabins.size() != 2
+      || l.cabins[0].cat != TravelCategory::kFirst || l.cabins[0].first_row != 4
+      || l.cabins[1].labels != labels || l.cabins[1].types != types
+      || l.cabins[1].first_row != 1 || l.cabins[1].rows != 3
+      || !l.cabins[1].is_exit_row(2) || l.cabins[1].is_exit_row(1)
+      || l.cabins[1].is_exit_row(1000)) {
+    err_string += "  wrong layout\n";
+    ++result;
+  }
+  const std::vector<std::pair<std::string, std::pair<int, int> > > bad = {
+    {"", {1, 1}},
+    {"plane X", {1, 1}},
+    {"flight X\nrows 3", {2, 1}},
+    {"flight X\neconomy\n  rows ten", {3, 8}},
+    {"flight X\neconomy rows 3\nseats A B,, C", {3, 11}},
+    {"flight X\neconomy rows 3\nseats A B,", {3, 11}},
+    {"flight X\neconomy rows 3 emergency", {2, 25}},
+    {"flight X\npenalty weight x", {2, 16}},
+    {"flight X\npenalty wait 1", {2, 1}}};
+  for (auto& b : bad)
+    try {
+      detail::parse_layout(b.first, l);
+      err_string += "  accepted '" + b.first + "'\n";
+      ++result;
+    }
+    catch (Flight::ParseError& e) {
+      if (e.line() != b.second.first || e.column() != b.second.second) {
+	err_string += "  wrong position " + std::to_string(e.line()) + ":"
+	  + std::to_string(e.column()) + " for '" + b.first + "'\n";
+	++result;
+      }
+    }
+  if (result)
+    std::cout << "Layout parser -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Layout parser -- OK" << std::endl;
+  return result;
+}
+
+// manifests with many groups, chunk boundaries and error positions
+int check_manifest() {
+  int result = 0;
+  std::string err_string;
+  const std::string manifest =
+    "# reservation export\neconomy\nKate window adult\nJack AISLE minor\n\n"
+    "Business\n  Ben none adult  \r\neconomy\nHugo window adult\n\t\n";
+  for (size_t chunk : {size_t(1), size_t(7), ManifestReader::default_chunk}) {
+    std::istringstream in(manifest);
+    ManifestReader r(in, chunk);
+    PassengerGroup g(TravelCategory::kFirst);
+    std::string got;
+    while (r.next(g)) {
+      got += detail::CatMap::instance().desc(g.cat()) + ":";
+      for (const auto& p : g)
+	got += " " + p->get_name() + "/" + detail::CatMap::instance().desc(p->get_seat_type())
+	  + (p->is_minor() ? "m" : "");
+      got += ";";
+    }
+    if (got != "economy: Kate/W Jack/Am;business: Ben/;economy: Hugo/W;") {
+      err_string += "  chunk " + std::to_string(chunk) + " read '" + got + "'\n";
+      ++result;
+    }
+  }
+  // no trailing passenger from trailing white space
+  std::ofstream("basic_checks_passengers.asc") << "business\nJohn window adult\n\n  \n";
+  PassengerGroup single("basic_checks_passengers.asc");
+  if (single.size() != 1 || single.cat() != TravelCategory::kBusiness) {
+    err_string += "  wrong single group\n";
+    ++result;
+  }
+  const std::vector<std::pair<std::string, std::pair<int, int> > > bad = {
+    {"Kate window adult", {1, 1}},
+    {"economy\nKate window", {2, 12}},
+    {"economy\nKate window adult\nJack seat adult", {3, 6}},
+    {"economy\nKate window old", {2, 13}},
+    {"economy\nKate window adult x", {2, 19}},
+    {"coach\nKate window adult", {1, 1}},
+    {"economy\n\nfirst\nKate window adult", {1, 1}}};
+  for (auto& b : bad)
+    try {
+      std::istringstream in(b.first);
+      ManifestReader r(in);
+      PassengerGroup g(TravelCategory::kEconomy);
+      while (r.next(g)) ;
+      err_string += "  accepted '" + b.first + "'\n";
+      ++result;
+    }
+    catch (Flight::ParseError& e) {
+      if (e.line() != b.second.first || e.column() != b.second.second) {
+	err_string += "  wrong position " + std::to_string(e.line()) + ":"
+	  + std::to_string(e.column()) + " for '" + b.first + "'\n";
+	++result;
+      }
+    }
+  if (result)
+    std::cout << "Manifest reader -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Manifest reader -- OK" << std::endl;
+  return result;
+}
+
+// flights from compiled images behave like the ones from text
+int check_layout_image() {
+  int result = 0;
+  std::string err_string;
+  std::string file = write_flight("basic_checks_flight.asc",
+				  std::string(sample_flight) + "penalty weight 2\n");
+  Flight::compile(file, "basic_checks_flight.img");
+  Flight text(file);
+  Flight image("basic_checks_flight.img");
+  Flight copy(text);
+  for (Flight* f : {&text, &image, &copy}) {
+    f->checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+    PassengerGroup g(TravelCategory::kEconomy);
+    g.push("Kate", SeatType::kWindow, false);
+    g.push("Jack", SeatType::kAisle, true);
+    g.push("Hugo", SeatType::kOther, false);
+    f->checkin(g);
+    f->checkin(TravelCategory::kBusiness, "John", SeatType::kAisle);
+  }
+  if (show(text) != show(image) || show(copy) != show(text)
+      || image.get_penalties().weight != 2 || image.n_seats() != text.n_seats()) {
+    err_string += "  image flight differs\n";
+    ++result;
+  }
+  // the neighbours come from the image's own table
+  for (int id = 0; id < text.n_seats(); ++id)
+    for (Neighbor kind : {Neighbor::kSameRow, Neighbor::kAcrossAisle, Neighbor::kFrontBack})
+      if (image.occupied_neighbors(id, kind) != text.occupied_neighbors(id, kind)) {
+	err_string += "  neighbours of " + text.seat_label(id) + " differ\n";
+	++result;
+      }
+  // damaged images are refused
+  std::string bytes;
+  {
+    std::ifstream in("basic_checks_flight.img", std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  for (size_t pos : {size_t(9), bytes.size() / 2, bytes.size() - 1, bytes.size()}) {
+    std::string bad = bytes.substr(0, pos);
+    if (pos < bytes.size())
+      bad += char(bytes[pos] ^ 1) + bytes.substr(pos + 1);
+    else
+      bad.pop_back();
+    write_flight("basic_checks_flight.img", bad);
+    try {
+      Flight f("basic_checks_flight.img");
+      err_string += "  damaged image at " + std::to_string(pos) + " accepted\n";
+      ++result;
+    }
+    catch (Flight::InputFileFormatError&) { }
+  }
+  if (result)
+    std::cout << "Layout image -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Layout image -- OK" << std::endl;
+  return result;
+}
+
+// freeing and moving passengers, and the free seat bitmap under it
+int check_cancel() {
+  int result = 0;
+  std::string err_string;
+  std::mt19937 rng(5);
+  detail::Bitmap bits;
+  std::vector<bool> ref(10000);
+  bits.resize(ref.size());
+  for (int k = 0; k < 20000; ++k) {
+    const size_t i = rng() % ref.size();
+    // long runs of set bits, to get full words
+    if (rng() % 4) {
+      bits.set(i);
+      ref[i] = true;
+    }
+    else {
+      bits.reset(i);
+      ref[i] = false;
+    }
+    if (k % 1000)
+      continue;
+    size_t first = rng() % ref.size(), last = rng() % (ref.size() + 1);
+    if (first > last)
+      std::swap(first, last);
+    std::vector<size_t> seen, known;
+    bits.each_clear(first, last, [&](size_t j) { seen.push_back(j); });
+    for (size_t j = first; j < last; ++j)
+      if (!ref[j])
+	known.push_back(j);
+    if (seen != known) {
+      err_string += "  wrong clear bits in [" + std::to_string(first) + ", "
+	+ std::to_string(last) + ")\n";
+      ++result;
+    }
+  }
+  for (bool arena : {false, true}) {
+    Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+    f.set_arena(arena);
+    PassengerGroup g(TravelCategory::kBusiness);
+    for (int i = 0; i < 12; ++i)
+      g.push("P" + std::to_string(i), SeatType::kOther, false);
+    f.checkin(g);
+    // a full cabin, until someone cancels
+    if (f.checkin(TravelCategory::kBusiness, "Late", SeatType::kOther)
+	!= Flight::AssignResult::kOverbooked
+	|| !f.cancel("4B") || f.cancel("4B") || f.cancel("99Z")
+	|| f.checkin(TravelCategory::kBusiness, "Late", SeatType::kOther)
+	!= Flight::AssignResult::kOk) {
+      err_string += "  wrong cancel\n";
+      ++result;
+    }
+    f.checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+    if (f.move("6A", "15F") != Flight::AssignResult::kOk
+	|| f.move("6A", "7A") != Flight::AssignResult::kSeatUnavailable
+	|| f.move("15F", "3A") != Flight::AssignResult::kSeatUnavailable
+	|| f.move("3A", "15F") != Flight::AssignResult::kSeatUnavailable
+	|| show(f).find("15F(W)::Ben") == std::string::npos
+	|| show(f).find("6A(W)::----") == std::string::npos
+	|| show(f).find("::Late") == std::string::npos) {
+      err_string += "  wrong move\n" + show(f);
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Cancel and move -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Cancel and move -- OK" << std::endl;
+  return result;
+}
+
+// runs of empty seats, against a brute force count, and groups
+// seated within one run in PlacementMode::kRuns
+int check_free_runs() {
+  int result = 0;
+  std::string err_string;
+  std::mt19937 rng(7);
+  const int n = 10000, split = 3000;
+  detail::Bitmap bits;
+  std::vector<bool> ref(n);
+  bits.resize(n);
+  detail::FreeRuns runs;
+  runs.clear(n);
+  runs.add(0, bits, 0, split);
+  runs.add(1, bits, split, n);
+  for (int k = 0; k < 40000; ++k) {
+    // mostly taken, with a few long runs left
+    const int i = k < 20000 ? rng() % n : rng() % 500 + 4000;
+    const int cabin = i >= split;
+    if ((ref[i] = !ref[i]))
+      bits.set(i);
+    else
+      bits.reset(i);
+    runs.update(cabin, bits, i, cabin ? split : 0, cabin ? n : split);
+    if (k % 997)
+      continue;
+    const size_t first = rng() % n, last = rng() % (n + 1);
+    size_t next = last, prev = first;
+    for (size_t j = first; j < last; ++j)
+      if (ref[j]) {
+	next = std::min(next, j);
+	prev = j + 1;
+      }
+    if (first < last
+	&& (bits.next_set(first, last) != next || bits.prev_set_end(first, last) != prev)) {
+      err_string += "  wrong set bit search in [" + std::to_string(first) + ", "
+	+ std::to_string(last) + ")\n";
+      ++result;
+    }
+    for (int length : {1, 2, 5, 64}) {
+      std::vector<std::pair<int, int> > seen, known;
+      for (int c = 0; c < 2; ++c)
+	runs.each(c, length, [&](int a, int b) { seen.emplace_back(a, b); });
+      for (int j = 0; j < n; ) {
+	int e = j;
+	while (e < n && !ref[e] && (e == j || e != split)) ++e;
+	if (e - j >= length)
+	  known.emplace_back(j, e);
+	j = std::max(e, j + 1);
+      }
+      std::sort(seen.begin(), seen.end());
+      if (seen != known) {
+	err_string += "  wrong runs of " + std::to_string(length) + " after "
+	  + std::to_string(k) + " updates\n";
+	++result;
+      }
+    }
+  }
+  for (bool late : {false, true}) {
+    Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+    if (!late)
+      f.set_placement_mode(PlacementMode::kRuns);
+    // economy (ids 16 to 75) in runs of two, but for the last six
+    for (int id = 18; id < 70; id += 3)
+      f.checkin(TravelCategory::kEconomy, "X", false, f.seat(id).get_desc());
+    if (late)
+      f.set_placement_mode(PlacementMode::kRuns);
+    // names on seats, by id
+    auto seated = [&f](const std::string& name) {
+      std::vector<int> ids;
+      for (int id = 0; id < f.n_seats(); ++id)
+	if (f.seat(id).get_passenger() && f.seat(id).get_passenger()->get_name() == name)
+	  ids.push_back(id);
+      return ids;
+    };
+    auto group = [&f](const std::string& name, int size) {
+      PassengerGroup g(TravelCategory::kEconomy);
+      for (int i = 0; i < size; ++i)
+	g.push(name, SeatType::kOther, false);
+      return f.checkin(g);
+    };
+    group("Three", 3);
+    const std::vector<int> three = seated("Three");
+    f.cancel(f.seat(42).get_desc());
+    group("Five", 5);
+    const std::vector<int> five = seated("Five");
+    // no run of four left, the group is split
+    const Flight::AssignResult four = group("Four", 4);
+    if (three.size() != 3 || three.back() - three.front() != 2 || three.front() < 70
+	|| five != std::vector<int>({40, 41, 42, 43, 44})
+	|| four != Flight::AssignResult::kOk || seated("Four").size() != 4) {
+      err_string += "  wrong placement in runs\n" + show(f);
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Free runs -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Free runs -- OK" << std::endl;
+  return result;
+}
+
+// counters and latencies of a flight, and of the process
+int check_stats() {
+  int result = 0;
+  std::string err_string;
+  const std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  StatsRegistry::instance().reset();
+  Flight f(file);
+  PassengerGroup g(TravelCategory::kEconomy);
+  g.push("Kate", SeatType::kWindow, false);
+  g.push("Jack", SeatType::kAisle, false);
+  f.checkin(g);
+  f.checkin(TravelCategory::kEconomy, "Hugo", SeatType::kOther);
+  f.checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+  f.checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+  f.checkin(TravelCategory::kFirst, "Locke", false, "15F");
+  PassengerGroup big(TravelCategory::kFirst);
+  for (int i = 0; i < 5; ++i)
+    big.push("P" + std::to_string(i), SeatType::kOther, false);
+  std::vector<PassengerGroup> batch(1, big);
+  f.checkin_batch(batch);
+  // another thread, gone before the total is taken
+  Stats other;
+  std::thread([&]() {
+      Flight t(file);
+      t.checkin(TravelCategory::kBusiness, "Sawyer", SeatType::kWindow);
+      other = t.stats();
+    }).join();
+  const Stats s = f.stats();
+  Stats total = StatsRegistry::instance().total();
+  Stats sum = s;
+  sum += other;
+#ifdef ASAP_NO_STATS
+  const bool counted = false;
+#else
+  const bool counted = true;
+#endif
+  const uint64_t n = counted;
+  if (s.counters.matches != 3 * n || s.counters.overbooked != n
+      || s.counters.seat_unavailable != 2 * n || (s.counters.windows > 0) != counted
+      || s.counters.penalties > s.counters.windows
+      || s.ops[Stats::kLoad] != n || s.latency[Stats::kLoad].count() != n
+      || s.ops[Stats::kCheckinGroup] != n || s.latency[Stats::kCheckinGroup].count() != n
+      || s.ops[Stats::kCheckinPassenger] != n
+      || s.latency[Stats::kCheckinPassenger].count() != n
+      // only the first of the three is timed
+      || s.ops[Stats::kCheckinSeat] != 3 * n || s.latency[Stats::kCheckinSeat].count() != n
+      || s.ops[Stats::kCheckinBatch] != n || s.latency[Stats::kCheckinBatch].count() != n
+      || s.latency[Stats::kLoad].quantile(0.5) > s.latency[Stats::kLoad].max_ns()
+      || other.counters.matches != n) {
+    err_string += "  wrong flight stats\n";
+    ++result;
+  }
+  for (int op = 0; op < Stats::n_ops; ++op)
+    if (total.ops[op] != sum.ops[op]
+	|| total.latency[op].count() != sum.latency[op].count()
+	|| total.latency[op].max_ns() != sum.latency[op].max_ns()) {
+      err_string += std::string("  wrong total for ") + Stats::name(Stats::Op(op)) + "\n";
+      ++result;
+    }
+  if (total.counters.windows != sum.counters.windows
+      || total.counters.matches != sum.counters.matches
+      || total.counters.seat_unavailable != sum.counters.seat_unavailable) {
+    err_string += "  wrong total counters\n";
+    ++result;
+  }
+  StatsRegistry::instance().reset();
+  if (StatsRegistry::instance().total().latency[Stats::kLoad].count()) {
+    err_string += "  no reset\n";
+    ++result;
+  }
+  LatencyHistogram h;
+  for (uint64_t ns = 1; ns <= 1000; ++ns)
+    h.add(ns);
+  if (h.count() != 1000 || h.quantile(0.5) != 511 || h.quantile(1) != 1000
+      || h.quantile(0.001) != 1 || h.mean_ns() != 500.5) {
+    err_string += "  wrong histogram\n";
+    ++result;
+  }
+  if (result)
+    std::cout << "Stats -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Stats -- OK" << std::endl;
+  return result;
+}
+
+// seat maps as text, JSON and CSV
+int check_render() {
+  int result = 0;
+  std::string err_string;
+  for (bool arena : {false, true}) {
+    Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+    f.set_arena(arena);
+    f.checkin(TravelCategory::kEconomy, "O\"Brien,Jr", false, "6A");
+    f.checkin(TravelCategory::kFirst, "Hugo", SeatType::kWindow);
+    std::string text = "header\n";
+    f.render(text);
+    std::ostringstream stream;
+    f.render(stream);
+    if (text != "header\n" + show(f) || stream.str() != show(f)
+	|| show(f).find("10A(WE)::----, ") == std::string::npos
+	|| show(f).find("1B(W)::Hugo, ") == std::string::npos) {
+      err_string += "  wrong text\n" + text;
+      ++result;
+    }
+    std::string json;
+    f.render(json, RenderFormat::kJson);
+    size_t seats = 0;
+    for (size_t i = 0; (i = json.find("{\"seat\":", i)) != std::string::npos; ++i)
+      ++seats;
+    if (json.compare(0, 34, "{\"flight\":\"OCEANIC-815\",\"cabins\":[")
+	|| seats != static_cast<size_t>(f.n_seats())
+	|| json.find("{\"seat\":\"6A\",\"type\":\"window\",\"exit\":false,"
+		     "\"passenger\":\"O\\\"Brien,Jr\"}") == std::string::npos
+	|| json.find("{\"seat\":\"10B\",\"type\":\"none\",\"exit\":true,"
+		     "\"passenger\":null}") == std::string::npos
+	|| json.compare(json.size() - 5, 5, "]}]}\n")) {
+      err_string += "  wrong JSON\n" + json + "\n";
+      ++result;
+    }
+    std::string csv;
+    f.render(csv, RenderFormat::kCsv);
+    if (std::count(csv.begin(), csv.end(), '\n') != f.n_seats() + 1
+	|| csv.compare(0, 38, "category,row,seat,type,exit,passenger\n")
+	|| csv.find("\neconomy,6,6A,window,0,\"O\"\"Brien,Jr\"\n") == std::string::npos
+	|| csv.find("\nfirst,1,1A,window,0,\n") == std::string::npos) {
+      err_string += "  wrong CSV\n" + csv;
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Render -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Render -- OK" << std::endl;
+  return result;
+}
+
+// neighbours from the seats line, and groups charged for them
+int check_neighbors() {
+  int result = 0;
+  std::string err_string;
+  const std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  Flight::compile(file, "basic_checks_flight.img");
+  for (const char* name : {file.c_str(), "basic_checks_flight.img"}) {
+    Flight f(name);
+    for (const char* seat : {"8B", "8D", "9C", "6F"})
+      f.checkin(f.category(f.n_seats() - 1), "X", false, seat);
+    f.checkin(TravelCategory::kBusiness, "Y", false, "5D");
+    // counts by seat label: same row, across the aisle, front/back
+    auto near = [&f](const char* seat) {
+      for (int id = 0; id < f.n_seats(); ++id)
+	if (f.seat(id).get_desc() == seat)
+	  return std::to_string(f.occupied_neighbors(id, Neighbor::kSameRow))
+	    + std::to_string(f.occupied_neighbors(id, Neighbor::kAcrossAisle))
+	    + std::to_string(f.occupied_neighbors(id, Neighbor::kFrontBack));
+      return std::string();
+    };
+    // 8C is next to 8B, across from 8D and behind 9C; 7F is behind
+    // 6F but not next to it, though their ids are; 6D is not behind
+    // 5D, which is in another cabin
+    if (near("8C") != "111" || near("8A") != "100" || near("7B") != "001"
+	|| near("7F") != "001" || near("6D") != "000" || near("5C") != "100"
+	|| near("4D") != "001"
+	|| near("8E") != "100") {
+      err_string += std::string("  wrong counts in ") + name + "\n";
+      ++result;
+    }
+    f.cancel("9C");
+    f.cancel("8B");
+    if (near("8C") != "010" || near("8A") != "000") {
+      err_string += std::string("  wrong counts after cancel in ") + name + "\n";
+      ++result;
+    }
+  }
+  // 1C taken: kIds charges the window 1B 1A for the id next to it,
+  // across the aisle, and takes 1D 1B, next to 1C; kSeats does not
+  const std::string row = write_flight("basic_checks_flight.asc",
+				       "Flight ROW-1\nECONOMY\nrows 1\nseats A B, C D\n");
+  for (NeighborMode mode : {NeighborMode::kIds, NeighborMode::kSeats}) {
+    Flight f(row);
+    f.set_neighbor_mode(mode);
+    f.checkin(TravelCategory::kEconomy, "X", false, "1C");
+    PassengerGroup g(TravelCategory::kEconomy);
+    g.push("G", SeatType::kOther, false);
+    g.push("G", SeatType::kOther, false);
+    f.checkin(g);
+    const std::string expected = mode == NeighborMode::kIds
+      ? "1: 1A(W)::----, 1B(A)::G, 1C(A)::X, 1D(W)::G, \n"
+      : "1: 1A(W)::G, 1B(A)::G, 1C(A)::X, 1D(W)::----, \n";
+    if (show(f).find(expected) == std::string::npos) {
+      err_string += "  wrong seats\n" + show(f);
+      ++result;
+    }
+  }
+  // 1B taken: each weight alone keeps a passenger off the seat next
+  // to it of its kind, 1A, 1C across the aisle or 2B behind it, in
+  // the file and the image alike, and reoptimize counts the same
+  const std::pair<const char*, std::string> weights[] = {
+    {"neighbor_seat_occupied", "1A"}, {"neighbor_across_aisle", "1C"},
+    {"neighbor_front_back", "2B"}};
+  for (const auto& w : weights) {
+    const char* weight = w.first;
+    const std::string& charged = w.second;
+    write_flight("basic_checks_flight.asc",
+		 std::string("Flight ROW-2\nECONOMY\nrows 2\nseats A B, C D\n")
+		 + "penalty neighbor_seat_occupied 0\npenalty " + weight + " 500\n");
+    Flight::compile("basic_checks_flight.asc", "basic_checks_flight.img");
+    for (const char* name : {"basic_checks_flight.asc", "basic_checks_flight.img"}) {
+      Flight f(name);
+      f.set_neighbor_mode(NeighborMode::kSeats);
+      f.checkin(TravelCategory::kEconomy, "X", false, "1B");
+      f.checkin(TravelCategory::kEconomy, "Y", SeatType::kOther, false);
+      const std::string s = show(f);
+      const Flight::ReoptimizeResult r = f.reoptimize(std::chrono::steady_clock::now());
+      if (s.find("::Y,") == std::string::npos || s.find(charged + "(W)::Y,") != std::string::npos
+	  || s.find(charged + "(A)::Y,") != std::string::npos || r.before != f.total_penalty()) {
+	err_string += std::string("  ") + weight + " ignored in " + name + "\n" + s;
+	++result;
+      }
+    }
+  }
+  if (result)
+    std::cout << "Neighbors -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Neighbors -- OK" << std::endl;
+  return result;
+}
+
+// center of mass of the passengers, and the balance weight
+int check_balance() {
+  int result = 0;
+  std::string err_string;
+  Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+  for (const char* seat : {"6A", "15F", "8C"})
+    f.checkin(TravelCategory::kEconomy, "X", false, seat);
+  f.checkin(TravelCategory::kBusiness, "Y", false, "4D");
+  // 6A and 15F are 5 half seats left and right of the middle, 8C
+  // one to the left, 4D 3 to the right in a row of four
+  const LoadBalance& e = f.balance(TravelCategory::kEconomy);
+  const LoadBalance all = f.balance();
+  if (e.passengers != 3 || e.row_sum != 29 || e.lateral_sum != -1
+      || all.passengers != 4 || all.row_sum != 33 || all.lateral_sum != 2
+      || all.row() != 8.25 || all.lateral() != 0.25) {
+    err_string += "  wrong balance\n";
+    ++result;
+  }
+  f.cancel("8C");
+  if (e.passengers != 2 || e.row() != 10.5 || e.lateral() != 0) {
+    err_string += "  wrong balance after cancel\n";
+    ++result;
+  }
+  // front left is taken: weight alone picks the center row, the
+  // balance weight the back right
+  const std::string front =
+    "Flight FRONT\nECONOMY\nrows 5\nseats A B, C D\ncenter 3\n";
+  for (const char* weight : {"", "penalty balance 5\n"}) {
+    write_flight("basic_checks_flight.asc", std::string(front) + weight);
+    Flight::compile("basic_checks_flight.asc", "basic_checks_flight.img");
+    for (const char* name : {"basic_checks_flight.asc", "basic_checks_flight.img"}) {
+      Flight g(name), h(name);
+      for (Flight* x : {&g, &h})
+	for (const char* seat : {"1A", "1B", "2A", "2B"})
+	  x->checkin(TravelCategory::kEconomy, "X", false, seat);
+      g.checkin(TravelCategory::kEconomy, "A", SeatType::kOther, false);
+      g.checkin(TravelCategory::kEconomy, "B", SeatType::kOther, false);
+      const std::string expected = *weight ? "5D(W)::A" : "3D(W)::A";
+      if (show(g).find(expected) == std::string::npos) {
+	err_string += std::string("  wrong seat in ") + name + "\n" + show(g);
+	++result;
+      }
+      // a batch scores the second passenger with the first seated
+      std::vector<PassengerGroup> batch(2, PassengerGroup(TravelCategory::kEconomy));
+      batch[0].push("A", SeatType::kOther, false);
+      batch[1].push("B", SeatType::kOther, false);
+      h.checkin_batch(batch);
+      if (show(g) != show(h)) {
+	err_string += std::string("  batch differs in ") + name + "\n" + show(h);
+	++result;
+      }
+    }
+  }
+  if (result)
+    std::cout << "Balance -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Balance -- OK" << std::endl;
+  return result;
+}
+
+// local search after the check-ins
+int check_reoptimize() {
+  int result = 0;
+  std::string err_string;
+  const char* journal = "basic_checks_reopt.journal";
+  std::remove(journal);
+  std::remove((std::string(journal) + ".snap").c_str());
+  // row 1 runs C B A, row 2 A B C: X and Y take ids 3 and 5, W
+  // picks 1A, and the group is split around them
+  const std::string file = write_flight("basic_checks_flight.asc",
+					"Flight T\nECONOMY\nrows 3\nseats A B C\ncenter 2\n");
+  Flight f(file);
+  f.open_journal(journal);
+  f.checkin(TravelCategory::kEconomy, "X", SeatType::kOther, false);
+  f.checkin(TravelCategory::kEconomy, "Y", SeatType::kOther, false);
+  f.checkin(TravelCategory::kEconomy, "W", false, "1A");
+  PassengerGroup g(TravelCategory::kEconomy);
+  g.push("K", SeatType::kWindow, false);
+  g.push("J", SeatType::kWindow, false);
+  g.push("H", SeatType::kAisle, false);
+  f.checkin(g);
+  const std::string before = show(f);
+  // no time, no moves
+  Flight::ReoptimizeResult r = f.reoptimize(std::chrono::steady_clock::now());
+  if (r.tried || r.before != f.total_penalty() || r.after != r.before || show(f) != before) {
+    err_string += "  moved without time\n";
+    ++result;
+  }
+  r = f.reoptimize(std::chrono::steady_clock::now() + std::chrono::milliseconds(20));
+  const std::string after = show(f);
+  if (r.before != 127 || !(r.after < r.before) || r.after != f.total_penalty()
+      || !r.kept || after.find("1A(W)::W,") == std::string::npos) {
+    err_string += "  wrong result " + std::to_string(r.before) + " -> "
+      + std::to_string(r.after) + "\n" + after;
+    ++result;
+  }
+  for (const char* name : {"X", "Y", "W", "K", "J", "H"})
+    if (after.find(std::string("::") + name + ",") == std::string::npos) {
+      err_string += std::string("  lost ") + name + "\n";
+      ++result;
+    }
+  // the moves are journaled
+  f.close_journal();
+  Flight h(file);
+  h.open_journal(journal);
+  if (show(h) != after) {
+    err_string += "  journal differs\n" + show(h);
+    ++result;
+  }
+  if (result)
+    std::cout << "Reoptimize -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Reoptimize -- OK" << std::endl;
+  return result;
+}
+
+// flights on one layout seat like flights of their own, and apart
+int check_shared_layout() {
+  int result = 0;
+  std::string err_string;
+  const std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  Flight::compile(file, "basic_checks_flight.img");
+  for (const char* name : {"basic_checks_flight.asc", "basic_checks_flight.img"}) {
+    auto layout = AircraftLayout::load(name);
+    Flight own(name), a(layout), b(layout, "OCEANIC-816");
+    const std::string empty = show(b);
+    if (a.layout() != layout || b.layout() != layout || a.n_seats() != own.n_seats()
+	|| show(a) != show(own) || empty.find("FLIGHT OCEANIC-816\n") != 0) {
+      err_string += std::string("  wrong flights on ") + name + "\n";
+      ++result;
+    }
+    for (Flight* f : {&own, &a}) {
+      PassengerGroup g(TravelCategory::kEconomy);
+      g.push("Kate", SeatType::kWindow, false);
+      g.push("Jack", SeatType::kAisle, false);
+      f->checkin(g);
+      f->checkin(TravelCategory::kBusiness, "Hugo", SeatType::kWindow, false);
+      f->checkin(TravelCategory::kEconomy, "Sawyer", false, "15F");
+      // the cancelled slot goes to the next passenger
+      f->cancel("15F");
+      f->checkin(TravelCategory::kFirst, "Ben", false, "1A");
+      f->move("1A", "2B");
+      f->set_arena(true);
+      f->checkin(TravelCategory::kEconomy, "Locke", SeatType::kOther, true);
+      f->set_arena(false);
+    }
+    // a copy has its own occupancy, on the same layout
+    Flight c = a;
+    c.checkin(TravelCategory::kEconomy, "Claire", false, "15F");
+    if (show(a) != show(own) || show(b) != empty || c.layout() != layout
+	|| show(c) == show(a) || show(c).find("15F(W)::Claire") == std::string::npos) {
+      err_string += std::string("  wrong seating on ") + name + "\n" + show(a) + show(c);
+      ++result;
+    }
+  }
+  if (result)
+    std::cout << "Shared layout -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Shared layout -- OK" << std::endl;
+  return result;
+}
+
+// flights restored from journal and snapshots seat everyone as before
+int check_journal() {
+  int result = 0;
+  std::string err_string;
+  const std::string file = write_flight("basic_checks_flight.asc", sample_flight);
+  const char* journal = "basic_checks_journal";
+  const std::string snap = std::string(journal) + ".snap";
+  // a few check-ins of each kind
+  auto checkins = [](Flight& f, int round) {
+    const std::string n = std::to_string(round);
+    f.checkin(TravelCategory::kEconomy, "Ben" + n, false, std::to_string(6 + round) + "A");
+    PassengerGroup g(TravelCategory::kEconomy);
+    g.push("Kate" + n, SeatType::kWindow, false);
+    g.push("Jack" + n, SeatType::kAisle, true);
+    f.checkin(g);
+    std::vector<PassengerGroup> batch(1, PassengerGroup(TravelCategory::kBusiness));
+    batch[0].push("John" + n, SeatType::kWindow, false);
+    f.checkin_batch(batch);
+    f.checkin(TravelCategory::kFirst, "Boone" + n, SeatType::kOther);
+    f.move(std::to_string(6 + round) + "A", std::to_string(13 + round) + "F");
+    f.checkin(TravelCategory::kEconomy, "Shannon" + n, false, std::to_string(6 + round) + "A");
+    f.cancel(std::to_string(6 + round) + "A");
+  };
+  for (size_t every : {0, 3}) {
+    std::remove(journal);
+    std::remove(snap.c_str());
+    std::string seen;
+    {
+      Flight f(file);
+      f.set_arena(every);
+      f.open_journal(journal, every);
+      checkins(f, 0);
+      checkins(f, 1);
+      f.sync_journal();
+      seen = show(f);
+    }
+    // torn record at the end, as left by a crash while writing
+    std::ofstream(journal, std::ios::app) << std::string("\x30\0\0\0\1\2", 6);
+    Flight g(file);
+    g.open_journal(journal, every);
+    if (show(g) != seen) {
+      err_string += "  restored " + std::to_string(every) + "\n" + show(g);
+      ++result;
+    }
+    // and journaling goes on where it stopped
+    checkins(g, 2);
+    seen = show(g);
+    g.close_journal();
+    Flight h(file);
+    h.open_journal(journal);
+    if (show(h) != seen) {
+      err_string += "  restored twice " + std::to_string(every) + "\n" + show(h);
+      ++result;
+    }
+    if (every && !std::ifstream(snap).good()) {
+      err_string += "  no snapshot\n";
+      ++result;
+    }
+  }
+  // a flight with passengers starts over, with a snapshot
+  {
+    Flight f(file);
+    checkins(f, 0);
+    f.open_journal(journal);
+    checkins(f, 1);
+    f.sync_journal();
+    const std::string seen = show(f);
+    f.close_journal();
+    Flight g(file);
+    g.open_journal(journal);
+    if (show(g) != seen) {
+      err_string += "  restored with snapshot\n" + show(g);
+      ++result;
+    }
+  }
+  // a crash after the snapshot, before the old journal is emptied:
+  // its records are older than the snapshot and skipped
+  {
+    std::ifstream in(journal, std::ios::binary);
+    const std::string old((std::istreambuf_iterator<char>(in)),
+			  std::istreambuf_iterator<char>());
+    Flight f(file);
+    checkins(f, 2);
+    f.open_journal(journal);
+    const std::string seen = show(f);
+    f.close_journal();
+    std::ofstream(journal, std::ios::binary | std::ios::trunc) << old;
+    Flight g(file);
+    g.open_journal(journal);
+    if (show(g) != seen) {
+      err_string += "  restored after crash\n" + show(g);
+      ++result;
+    }
+  }
+  // a name too long for an entry is cut, in the journal and the
+  // snapshot alike, and the entries after it still read back
+  for (size_t every : {0, 2}) {
+    std::remove(journal);
+    std::remove(snap.c_str());
+    const std::string name(70000, 'x');
+    {
+      Flight f(file);
+      f.open_journal(journal, every);
+      f.checkin(TravelCategory::kEconomy, name, false, "7A");
+      f.checkin(TravelCategory::kEconomy, "Ben", false, "7B");
+    }
+    Flight g(file);
+    g.open_journal(journal);
+    auto occupant = [&g](const char* seat) {
+      for (int id = 0; id < g.n_seats(); ++id)
+	if (g.seat(id).get_desc() == seat)
+	  return g.seat(id).get_passenger();
+      return std::shared_ptr<Passenger>();
+    };
+    const std::shared_ptr<Passenger> long_name = occupant("7A");
+    const std::shared_ptr<Passenger> ben = occupant("7B");
+    if (!long_name || long_name->get_name() != name.substr(0, 65535)
+	|| !ben || ben->get_name() != "Ben") {
+      err_string += "  long name " + std::to_string(every) + "\n";
+      ++result;
+    }
+  }
+  // journals of other flights are refused
+  Flight other(write_flight("basic_checks_flight.asc", "Flight OTHER-1\neconomy\nrows 3\nseats A B"));
+  try {
+    other.open_journal(journal);
+    err_string += "  accepted other flight's journal\n";
+    ++result;
+  }
+  catch (Flight::InputFileFormatError&) { }
+  if (result)
+    std::cout << "Journal -- ERROR" << std::endl << err_string;
+  else
+    std::cout <<  "Journal -- OK" << std::endl;
+  return result;
+}
+
+// the seating of main.cc, known value, with passengers as
+// shared_ptrs, in an arena, and moved between the two
+int check_sample_flight() {
+  int result = 0;
+  for (int mode = 0; mode < 3; ++mode) {
+    Flight f(write_flight("basic_checks_flight.asc", sample_flight));
+    f.set_arena(mode == 1);
+    f.checkin(TravelCategory::kEconomy, "Ben", false, "6A");
+    {
+      PassengerGroup g(TravelCategory::kEconomy);
+      g.push("Kate", SeatType::kWindow, false);
+      g.push("Jack", SeatType::kAisle, false);
+      g.push("Hugo", SeatType::kOther, false);
+      g.push("James", SeatType::kWindow, false);
+      f.checkin(g);
+    }
+    if (mode == 2)
+      f.set_arena(true);
+    PassengerGroup a(TravelCategory::kBusiness);
+    a.push("John", SeatType::kWindow, false);
+    a.push("Sayid", SeatType::kOther, false);
+    PassengerGroup b(TravelCategory::kEconomy);
+    b.push("Claire", SeatType::kWindow, false);
+    b.push("Charley", SeatType::kAisle, false);
+    b.push("Desmond", SeatType::kOther, false);
+    f.checkin(a);
+    f.checkin(b);
+    f.checkin(TravelCategory::kEconomy, "Boone", SeatType::kWindow);
+    if (mode == 2)
+      f.set_arena(false);
+    const std::string known =
+      "FLIGHT OCEANIC-815\n"
+      "---------  first  ---------\n"
+      "1: 1A(W)::----, 1B(W)::----, \n"
+      "2: 2A(W)::----, 2B(W)::----, \n"
+      "---------  business  ---------\n"
+      "3: 3A(W)::----, 3B(A)::----, 3C(A)::Sayid, 3D(W)::John, \n"
+      "4: 4A(W)::----, 4B(A)::----, 4C(A)::----, 4D(W)::----, \n"
+      "5: 5A(W)::----, 5B(A)::----, 5C(A)::----, 5D(W)::----, \n"
+      "---------  economy  ---------\n"
+      "6: 6A(W)::Ben, 6B()::----, 6C(A)::----, 6D(A)::----, 6E()::----, 6F(W)::----, \n"
+      "7: 7A(W)::----, 7B()::----, 7C(A)::----, 7D(A)::----, 7E()::----, 7F(W)::----, \n"
+      "8: 8A(W)::----, 8B()::----, 8C(A)::----, 8D(A)::----, 8E()::----, 8F(W)::----, \n"
+      "9: 9A(W)::----, 9B()::----, 9C(A)::----, 9D(A)::----, 9E()::----, 9F(W)::----, \n"
+      "10: 10A(WE)::Kate, 10B(E)::----, 10C(AE)::----, 10D(AE)::----, 10E(E)::----, 10F(WE)::Boone, \n"
+      "11: 11A(W)::James, 11B()::Hugo, 11C(A)::Jack, 11D(A)::----, 11E()::Charley, 11F(W)::Claire, \n"
+      "12: 12A(W)::----, 12B()::----, 12C(A)::----, 12D(A)::----, 12E()::----, 12F(W)::Desmond, \n"
+      "13: 13A(W)::----, 13B()::----, 13C(A)::----, 13D(A)::----, 13E()::----, 13F(W)::----, \n"
+      "14: 14A(W)::----, 14B()::----, 14C(A)::----, 14D(A)::----, 14E()::----, 14F(W)::----, \n"
+      "15: 15A(W)::----, 15B()::----, 15C(A)::----, 15D(A)::----, 15E()::----, 15F(W)::----, \n";
+    const std::string seen = show(f);
+    if (seen != known) {
+      std::cout << "Sample flight -- ERROR" << std::endl
+		<< "  arena mode " << mode << std::endl << seen;
+      ++result;
+    }
+  }
+  // interned names, across rehashing
+  detail::PassengerArena arena;
+  for (int i = 0; i < 3000; ++i)
+    arena.add("P" + std::to_string(i % 1000), SeatType::kAisle, i % 2);
+  if (arena.size() != 3000 || arena.n_names() != 1000 || arena.name(2500) != "P500"
+      || !arena.is_minor(2501) || arena.type(7) != SeatType::kAisle) {
+    std::cout << "Sample flight -- ERROR" << std::endl << "  wrong arena" << std::endl;
+    ++result;
+  }
+  if (!result)
+    std::cout <<  "Sample flight -- OK" << std::endl;
+  return result;
+}
+
 int main() {
-  int result = check_penalties() + check_find_best_match() + check_assign();
+  int result = check_penalties() + check_find_best_match() + check_assign()
+    + check_window_scorer() + check_optimal_assign() + check_seat_map()
+    + check_seat_labels() + check_scorer_erase() + check_batch()
+    + check_sample_flight() + check_engine() + check_async_engine()
+    + check_first_min() + check_penalty_policy() + check_layout_parser()
+    + check_layout_image() + check_manifest() + check_cancel() + check_journal()
+    + check_free_runs() + check_stats() + check_render() + check_neighbors()
+    + check_balance() + check_reoptimize() + check_shared_layout();
   std::cout << result << " tests failed" << std::endl;
   return result;
 }
@@ -0,0 +1,455 @@
+////////////////////////////////////////////////////////////
+//
+// Benchmark suite, built by make bench. Synthetic aircraft, from a
+// regional jet to an A380-sized cabin, are loaded with random
+// manifests, in these scenarios:
+//   load    Flight objects read from a flight file
+//   single  passengers checked in one by one
+//   group   groups checked in
+//   batch   the same no. of groups checked in by one checkin_batch,
+//           latency is the batch's time over its no. of groups
+//   claim   passengers checked in on a given seat
+//   show    Flight::show of a loaded flight, to a null stream
+//   render_text, render_json, render_csv
+//           Flight::render of a loaded flight, to a reused string
+//   async   groups for several flights checked in by many threads at
+//           once through CheckinEngine::checkin_async, latency from
+//           submitting to the reply
+//   locked  the same, each thread calling Flight::checkin under a
+//           mutex per flight
+//   scaling_1, scaling_2, scaling_4, scaling_8
+//           async on an engine of 1, 2, 4 and 8 workers, to see
+//           how throughput scales with cores
+// Every scenario prints one JSON object per line and aircraft, with
+// throughput, p50/p99/p999 latency, allocations per operation and,
+// for the check-in scenarios, the share of seat preferences met and
+// of groups split across non-adjacent seats.
+//
+// Options, as name=value:
+//   seed         random seed (1)
+//   rounds       fresh flights per scenario and aircraft (3)
+//   load         share of each cabin filled (0.9)
+//   group_max    largest group (6)
+//   p_single     share of groups of one (0.4), the others are
+//                uniform in 2 to group_max
+//   p_window     share of passengers asking for a window (0.3)
+//   p_aisle      share of passengers asking for an aisle (0.3)
+//   p_minor      share of minors (0.1)
+//   aircraft     only this aircraft, e.g. a380
+//   flights      flights of each aircraft for async and locked (8)
+//   submitters   threads submitting check-ins (2000)
+//   workers      engine worker threads for async (no. of cores)
+//   max_batch    see CheckinEngine::set_max_batch (32)
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <flight.hpp>
+#include <engine.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+
+using namespace asap;
+
+static std::atomic<size_t> n_allocs(0);
+
+void* operator new(std::size_t n) {
+  n_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+  struct Options {
+    unsigned seed = 1;
+    int rounds = 3;
+    double load = 0.9;
+    int group_max = 6;
+    double p_single = 0.4;
+    double p_window = 0.3;
+    double p_aisle = 0.3;
+    double p_minor = 0.1;
+    std::string aircraft;
+    int flights = 8;
+    int submitters = 2000;
+    unsigned workers = std::thread::hardware_concurrency();
+    size_t max_batch = 32;
+  };
+
+  // rows of each cabin, and its seats as in a flight file
+  struct Aircraft {
+    const char* name;
+    int first_rows;
+    const char* first_seats;
+    int business_rows;
+    const char* business_seats;
+    int economy_rows;
+    const char* economy_seats;
+  };
+
+  const Aircraft aircraft[] = {
+    {"regional", 0, "", 3, "A, C D", 20, "A B, C D"},
+    {"narrowbody", 0, "", 4, "A B, C D", 26, "A B C, D E F"},
+    {"widebody", 2, "A, D G, K", 10, "A C, D G, H K", 40, "A B C, D E F G, H J K"},
+    {"a380", 3, "A, E F, K", 20, "A C, D E F G, H K", 100, "A B C, D E F G, H J K"},
+  };
+
+  std::string flight_file(const Aircraft& a) {
+    std::string result = std::string("Flight ") + a.name + "\n";
+    int rows = 0;
+    auto cabin = [&](const char* cat, int n, const char* seats) {
+      if (!n)
+	return;
+      result += std::string("\n") + cat + "\nrows " + std::to_string(n)
+	+ "\nseats " + seats + "\ncenter " + std::to_string(rows + n / 2 + 1) + "\n";
+      rows += n;
+    };
+    cabin("FIRST", a.first_rows, a.first_seats);
+    cabin("BUSINESS", a.business_rows, a.business_seats);
+    cabin("ECONOMY", a.economy_rows, a.economy_seats);
+    // exit rows a third and two thirds down the plane
+    result += "emergency " + std::to_string(rows / 3 + 1) + "\nemergency "
+      + std::to_string(2 * rows / 3 + 1) + "\n";
+    return result;
+  }
+
+  // random groups filling opts.load of every cabin, passengers are
+  // named g<group>_<member>
+  std::vector<PassengerGroup> manifest(const Flight& f, const Options& opts,
+				       std::mt19937& rng) {
+    std::uniform_real_distribution<double> u;
+    std::array<int, 3> left{};
+    for (int id = 0; id < f.n_seats(); ++id)
+      ++left[static_cast<int>(f.category(id))];
+    for (auto& n : left)
+      n = static_cast<int>(n * opts.load);
+    std::vector<PassengerGroup> result;
+    for (int c = 0; c < 3; ++c)
+      while (left[c]) {
+	int size = u(rng) < opts.p_single || opts.group_max < 2 ? 1
+	  : 2 + static_cast<int>(rng() % (opts.group_max - 1));
+	size = std::min(size, left[c]);
+	left[c] -= size;
+	PassengerGroup g(static_cast<TravelCategory>(c));
+	for (int i = 0; i < size; ++i) {
+	  const double p = u(rng);
+	  const SeatType type = p < opts.p_window ? SeatType::kWindow
+	    : p < opts.p_window + opts.p_aisle ? SeatType::kAisle : SeatType::kOther;
+	  g.push("g" + std::to_string(result.size()) + "_" + std::to_string(i),
+		 type, u(rng) < opts.p_minor);
+	}
+	result.push_back(std::move(g));
+      }
+    std::shuffle(result.begin(), result.end(), rng);
+    return result;
+  }
+
+  // latencies and allocations of one scenario, over all rounds
+  struct Result {
+    std::vector<double> ns;
+    size_t allocs = 0;
+    double seconds = 0;
+    // passengers asking for a window or aisle, those who got one,
+    // groups of more than one and those split
+    long picky = 0, pleased = 0, groups = 0, split = 0;
+  };
+
+  template <typename F>
+  void time(Result& r, F f) {
+    const size_t allocs = n_allocs;
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    r.allocs += n_allocs - allocs;
+    const double s = std::chrono::duration<double>(end - start).count();
+    r.seconds += s;
+    r.ns.push_back(s * 1e9);
+  }
+
+  // preferences met and groups split, from the names on the seats
+  void quality(const Flight& f, Result& r) {
+    std::vector<std::pair<int, int> > seats; // group, id
+    for (int id = 0; id < f.n_seats(); ++id) {
+      const Seat s = f.seat(id);
+      const Passenger* p = s.get_passenger().get();
+      if (!p)
+	continue;
+      if (p->get_seat_type() != SeatType::kOther) {
+	++r.picky;
+	r.pleased += p->get_seat_type() == s.get_seat_type();
+      }
+      seats.emplace_back(std::atoi(p->get_name().c_str() + 1), id);
+    }
+    std::sort(seats.begin(), seats.end());
+    for (size_t i = 0; i < seats.size(); ) {
+      size_t j = i;
+      while (j < seats.size() && seats[j].first == seats[i].first) ++j;
+      if (j - i > 1) {
+	++r.groups;
+	r.split += seats[j - 1].second - seats[i].second + 1 != static_cast<int>(j - i);
+      }
+      i = j;
+    }
+  }
+
+  double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty())
+      return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+  }
+
+  void report(const char* scenario, const Aircraft& a, int n_seats, Result& r,
+	      bool with_quality) {
+    std::sort(r.ns.begin(), r.ns.end());
+    const double ops = r.ns.size();
+    std::printf("{\"version\": \"%s\", \"scenario\": \"%s\", \"aircraft\": \"%s\", "
+		"\"seats\": %d, \"ops\": %.0f, \"ops_per_s\": %.1f, "
+		"\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, "
+		"\"allocs_per_op\": %.2f",
+		PACKAGE_VERSION, scenario, a.name, n_seats, ops,
+		r.seconds > 0 ? ops / r.seconds : 0., percentile(r.ns, 0.5),
+		percentile(r.ns, 0.99), percentile(r.ns, 0.999), ops ? r.allocs / ops : 0.);
+    if (with_quality)
+      std::printf(", \"preferences_met\": %.4f, \"groups_split\": %.4f",
+		  r.picky ? double(r.pleased) / r.picky : 1.,
+		  r.groups ? double(r.split) / r.groups : 0.);
+    std::printf("}\n");
+    std::fflush(stdout);
+  }
+
+  // discards everything, for show
+  struct NullBuffer : std::streambuf {
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+  };
+
+  // the groups of all manifests, one per flight, submitted by
+  // opts.submitters threads at once, each by call(flight, group, ns),
+  // which sees to it that ns gets the group's latency by the time
+  // wait() returns
+  template <typename Call, typename Wait>
+  void concurrent(Result& r, std::vector<std::vector<PassengerGroup> >& manifests,
+		  const Options& opts, Call call, Wait wait) {
+    // every submitter gets every submitters-th group
+    std::vector<std::vector<std::pair<int, PassengerGroup*> > >
+      work(opts.submitters);
+    size_t n = 0;
+    for (size_t i = 0; i < manifests.size(); ++i)
+      for (auto& g : manifests[i])
+	work[n++ % work.size()].emplace_back(i, &g);
+    std::vector<double> ns(n);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < work.size(); ++t)
+      threads.emplace_back([&, t]() {
+	  while (!go)
+	    std::this_thread::yield();
+	  for (size_t j = 0; j < work[t].size(); ++j)
+	    call(work[t][j].first, *work[t][j].second, ns[t + j * work.size()]);
+	});
+    const size_t allocs = n_allocs;
+    const auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& t : threads)
+      t.join();
+    wait();
+    r.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()
+					       - start).count();
+    r.allocs += n_allocs - allocs;
+    r.ns.insert(r.ns.end(), ns.begin(), ns.end());
+  }
+
+  double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()
+						    - start).count();
+  }
+
+  void run(const Aircraft& a, const Options& opts) {
+    const std::string file = std::string("bench_") + a.name + ".asc";
+    std::ofstream(file) << flight_file(a);
+    std::mt19937 rng(opts.seed);
+    const int n_seats = Flight(file).n_seats();
+    Result load, single, group, batch, claim, show, async, locked;
+    Result render[3];
+    const unsigned scaling_workers[4] = {1, 2, 4, 8};
+    Result scaling[4];
+    const RenderFormat formats[3] = {RenderFormat::kText, RenderFormat::kJson,
+				     RenderFormat::kCsv};
+    for (int round = 0; round < opts.rounds; ++round) {
+      for (int k = 0; k < 20; ++k)
+	time(load, [&]() { Flight f(file); });
+      {
+	Flight f(file);
+	std::vector<PassengerGroup> groups = manifest(f, opts, rng);
+	for (auto& g : groups)
+	  for (const auto& p : g) {
+	    const TravelCategory cat = g.cat();
+	    time(single, [&]() {
+		f.checkin(cat, p->get_name(), p->get_seat_type(), p->is_minor()); });
+	  }
+	quality(f, single);
+      }
+      {
+	Flight f(file);
+	std::vector<PassengerGroup> groups = manifest(f, opts, rng);
+	for (auto& g : groups)
+	  time(group, [&]() { f.checkin(g); });
+	quality(f, group);
+	NullBuffer null;
+	std::streambuf* old = std::cout.rdbuf(&null);
+	for (int k = 0; k < 10; ++k)
+	  time(show, [&]() { f.show(); });
+	std::cout.rdbuf(old);
+	std::string out;
+	for (int k = 0; k < 30; ++k)
+	  for (int i = 0; i < 3; ++i)
+	    time(render[i], [&]() {
+		out.clear();
+		f.render(out, formats[i]);
+	      });
+      }
+      {
+	Flight f(file);
+	std::vector<PassengerGroup> groups = manifest(f, opts, rng);
+	Result all;
+	time(all, [&]() { f.checkin_batch(groups); });
+	batch.seconds += all.seconds;
+	batch.allocs += all.allocs;
+	batch.ns.insert(batch.ns.end(), groups.size(), all.ns[0] / groups.size());
+	quality(f, batch);
+      }
+      {
+	Flight f(file);
+	std::vector<int> ids(n_seats);
+	for (int id = 0; id < n_seats; ++id)
+	  ids[id] = id;
+	std::shuffle(ids.begin(), ids.end(), rng);
+	ids.resize(static_cast<size_t>(n_seats * opts.load));
+	std::vector<std::pair<TravelCategory, std::string> > claims;
+	for (int id : ids)
+	  claims.emplace_back(f.category(id), f.seat(id).get_desc());
+	const std::string name = "claim";
+	for (const auto& c : claims)
+	  time(claim, [&]() { f.checkin(c.first, name, false, c.second); });
+      }
+      {
+	const Flight f(file);
+	std::vector<std::vector<PassengerGroup> > manifests;
+	for (int i = 0; i < opts.flights; ++i)
+	  manifests.push_back(manifest(f, opts, rng));
+	std::vector<std::vector<PassengerGroup> > copies = manifests;
+	CheckinEngine engine(opts.workers);
+	engine.set_max_batch(opts.max_batch);
+	for (int i = 0; i < opts.flights; ++i)
+	  engine.add_flight(file);
+	concurrent(async, manifests, opts,
+		   [&engine](int i, PassengerGroup& g, double& ns) {
+		     const auto start = std::chrono::steady_clock::now();
+		     engine.checkin_async(i, std::move(g), [&ns, start](CheckinEngine::Reply) {
+			 ns = since(start); });
+		   },
+		   [&engine]() { engine.wait(); });
+	for (int i = 0; i < opts.flights; ++i)
+	  engine.submit(i, [&async](Flight& f) { quality(f, async); }).get();
+	std::vector<std::unique_ptr<Flight> > flights;
+	std::vector<std::mutex> locks(opts.flights);
+	for (int i = 0; i < opts.flights; ++i)
+	  flights.emplace_back(new Flight(file));
+	concurrent(locked, copies, opts,
+		   [&flights, &locks](int i, PassengerGroup& g, double& ns) {
+		     const auto start = std::chrono::steady_clock::now();
+		     std::lock_guard<std::mutex> lock(locks[i]);
+		     flights[i]->checkin(g);
+		     ns = since(start);
+		   },
+		   []() { });
+	for (const auto& f : flights)
+	  quality(*f, locked);
+      }
+      for (int k = 0; k < 4; ++k) {
+	const Flight f(file);
+	std::vector<std::vector<PassengerGroup> > manifests;
+	for (int i = 0; i < opts.flights; ++i)
+	  manifests.push_back(manifest(f, opts, rng));
+	CheckinEngine engine(scaling_workers[k]);
+	engine.set_max_batch(opts.max_batch);
+	for (int i = 0; i < opts.flights; ++i)
+	  engine.add_flight(file);
+	concurrent(scaling[k], manifests, opts,
+		   [&engine](int i, PassengerGroup& g, double& ns) {
+		     const auto start = std::chrono::steady_clock::now();
+		     engine.checkin_async(i, std::move(g), [&ns, start](CheckinEngine::Reply) {
+			 ns = since(start); });
+		   },
+		   [&engine]() { engine.wait(); });
+	for (int i = 0; i < opts.flights; ++i)
+	  engine.submit(i, [&scaling, k](Flight& f) { quality(f, scaling[k]); }).get();
+      }
+    }
+    std::remove(file.c_str());
+    report("load", a, n_seats, load, false);
+    report("single", a, n_seats, single, true);
+    report("group", a, n_seats, group, true);
+    report("batch", a, n_seats, batch, true);
+    report("claim", a, n_seats, claim, false);
+    report("show", a, n_seats, show, false);
+    report("render_text", a, n_seats, render[0], false);
+    report("render_json", a, n_seats, render[1], false);
+    report("render_csv", a, n_seats, render[2], false);
+    report("async", a, n_seats, async, true);
+    report("locked", a, n_seats, locked, true);
+    for (int k = 0; k < 4; ++k)
+      report(("scaling_" + std::to_string(scaling_workers[k])).c_str(), a, n_seats,
+	     scaling[k], true);
+  }
+
+  bool option(const std::string& arg, Options& opts) {
+    const size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+      return false;
+    const std::string name = arg.substr(0, eq);
+    const char* value = arg.c_str() + eq + 1;
+    if (name == "seed") opts.seed = std::strtoul(value, 0, 10);
+    else if (name == "rounds") opts.rounds = std::atoi(value);
+    else if (name == "load") opts.load = std::atof(value);
+    else if (name == "group_max") opts.group_max = std::atoi(value);
+    else if (name == "p_single") opts.p_single = std::atof(value);
+    else if (name == "p_window") opts.p_window = std::atof(value);
+    else if (name == "p_aisle") opts.p_aisle = std::atof(value);
+    else if (name == "p_minor") opts.p_minor = std::atof(value);
+    else if (name == "aircraft") opts.aircraft = value;
+    else if (name == "flights") opts.flights = std::max(std::atoi(value), 1);
+    else if (name == "submitters") opts.submitters = std::max(std::atoi(value), 1);
+    else if (name == "workers") opts.workers = std::strtoul(value, 0, 10);
+    else if (name == "max_batch") opts.max_batch = std::strtoul(value, 0, 10);
+    else return false;
+    return true;
+  }
+}
+
+int main(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i)
+    if (!option(argv[i], opts)) {
+      std::fprintf(stderr, "unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  opts.load = std::min(std::max(opts.load, 0.), 1.);
+  for (const auto& a : aircraft)
+    if (opts.aircraft.empty() || opts.aircraft == a.name)
+      run(a, opts);
+  return 0;
+}
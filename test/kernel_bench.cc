@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////
+//
+// Microbenchmark of the argmin kernel, against the scalar loop on
+// double penalties that seat_penalty used before. Prints one line
+// per (kernel, length): nanoseconds per call and per seat.
+// Then WindowScorer::best_window on a cabin of random seats, serial
+// and split over 2 and 4 threads of the SlicePool, and the cost of a
+// SlicePool::run of empty slices, from which the window count
+// where splitting starts to pay follows.
+
+#include <flight.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+using namespace asap;
+
+namespace {
+  const char* names[] = {"scalar", "ssse3", "avx2"};
+
+  // the loop the kernel replaces
+  size_t first_min_double(const unsigned char* data, size_t n, const double* pen) {
+    size_t j = 0;
+    for (size_t i = 1; i < n; ++i)
+      if (pen[data[i]] < pen[data[j]])
+	j = i;
+    return j;
+  }
+
+  template <typename F>
+  void run(const char* name, size_t n, F f) {
+    const size_t reps = std::max<size_t>(1000, (1 << 24) / n);
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r)
+      sink += f();
+    double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count() / reps;
+    std::printf("%-8s n=%-6zu %10.2f ns/call %8.3f ns/seat (%zu)\n",
+		name, n, ns, ns / n, sink % 10);
+  }
+}
+
+namespace {
+  void window_bench(std::mt19937& rng) {
+    const SeatType types[3] = {SeatType::kWindow, SeatType::kAisle, SeatType::kOther};
+    PassengerGroup g(TravelCategory::kEconomy);
+    for (int i = 0; i < 4; ++i)
+      g.push("", types[rng() % 3], false);
+    g.sort();
+    for (size_t n : {256, 1024, 4096, 16384}) {
+      detail::WindowScorer scorer;
+      for (size_t i = 0; i < n; ++i)
+	scorer.push_back(detail::seat_class(types[rng() % 3], rng() % 20 == 0),
+			 static_cast<int>(i), static_cast<double>(rng() % 40));
+      scorer.set_group(g.begin(), g.end());
+      for (unsigned threads : {1, 2, 4}) {
+	scorer.set_parallel(threads, 1);
+	const std::string name = "window/" + std::to_string(threads);
+	run(name.c_str(), n, [&]() { return scorer.best_window(); });
+      }
+    }
+    for (size_t threads : {2, 4}) {
+      auto noop = [](size_t) { };
+      const std::string name = "pool/" + std::to_string(threads);
+      run(name.c_str(), threads, [&]() {
+	  detail::SlicePool::instance().run(threads, noop);
+	  return size_t(0);
+	});
+    }
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  // ranks and penalties of an adult passenger wanting a window seat
+  double pen[16] = {0};
+  unsigned char rank[16] = {0};
+  for (int sc = 0; sc < detail::n_seat_classes; ++sc)
+    pen[sc] = detail::penalty(static_cast<SeatType>(sc / 2), sc % 2,
+			      SeatType::kWindow, false);
+  for (int sc = 0; sc < detail::n_seat_classes; ++sc)
+    for (int o = 0; o < detail::n_seat_classes; ++o)
+      rank[sc] += pen[o] < pen[sc];
+  std::printf("detected: %s\n", names[static_cast<int>(detail::detected_isa())]);
+  for (size_t n : {8, 32, 128, 600, 4096}) {
+    // mostly aisle and other seats, one window seat late in the range
+    std::vector<unsigned char> data(n);
+    for (auto& d : data)
+      d = 2 + rng() % 4;
+    data[n - n / 8 - 1] = 0;
+    run("double", n, [&]() { return first_min_double(data.data(), n, pen); });
+    for (auto isa : {detail::Isa::kScalar, detail::Isa::kSsse3, detail::Isa::kAvx2})
+      if (isa <= detail::detected_isa())
+	run(names[static_cast<int>(isa)], n,
+	    [&]() { return detail::first_min(data.data(), n, rank, isa); });
+  }
+  window_bench(rng);
+  return 0;
+}
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////
+//
+// Benchmark of the flight file parser. Prints layouts parsed per
+// second, for the layout alone (parse_layout on a buffer), for whole
+// Flight objects read from a file and for Flight objects loaded from
+// a compiled image, and for the seat map alone (AircraftLayout::load)
+// from either. The huge layout is a made-up cabin of 20000 seats.
+
+#include <flight.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+using namespace asap;
+
+namespace {
+  const char* small =
+    "Flight OCEANIC-815\n\n"
+    "FIRST\nrows 2\nseats A,B\n\n"
+    "BUSINESS\nrows 3\nseats A B,C D\n\n"
+    "ECONOMY\nrows 10\nseats A B C, D E F\nemergency 10\ncenter 11\n";
+
+  const char* wide =
+    "Flight LONGHAUL-1\n\n"
+    "FIRST\nrows 4\nseats A, D G, K\ncenter 3\n\n"
+    "BUSINESS\nrows 12\nseats A C, D E F G, H K\ncenter 10\n\n"
+    "ECONOMY\nrows 48\nseats A B C, D E F G, H J K\n"
+    "emergency 24\nemergency 25\nemergency 45\ncenter 40\n"
+    "penalty neighbor_seat_occupied 25\n";
+
+  std::string huge() {
+    std::string result = "Flight HUGE-1\n\nECONOMY\nrows 2000\nseats A B C, D E F G, H J K\n";
+    for (int row = 100; row < 2000; row += 100)
+      result += "emergency " + std::to_string(row) + "\n";
+    return result + "center 1000\n";
+  }
+
+  template <typename F>
+  void run(const char* name, size_t bytes, F f) {
+    size_t n = 0;
+    auto start = std::chrono::steady_clock::now();
+    double s = 0;
+    for (; s < 0.5; s = std::chrono::duration<double>(
+	   std::chrono::steady_clock::now() - start).count())
+      for (int k = 0; k < 100; ++k, ++n)
+	f();
+    std::printf("%-16s %10.0f layouts/s %8.1f MB/s\n", name, n / s, n * bytes / s / 1e6);
+  }
+}
+
+int main() {
+  const std::string huge_text = huge();
+  for (const char* text : {small, wide, huge_text.c_str()}) {
+    const std::string t(text);
+    const char* name = text == small ? "small" : text == wide ? "wide" : "huge";
+    detail::Layout layout;
+    run((std::string("parse ") + name).c_str(), t.size(),
+	[&]() { detail::parse_layout(t, layout); });
+    std::ofstream("parse_bench_flight.asc") << t;
+    run((std::string("Flight ") + name).c_str(), t.size(),
+	[&]() { Flight f("parse_bench_flight.asc"); });
+    Flight::compile("parse_bench_flight.asc", "parse_bench_flight.img");
+    run((std::string("image ") + name).c_str(), t.size(),
+	[&]() { Flight f("parse_bench_flight.img"); });
+    run((std::string("layout ") + name).c_str(), t.size(),
+	[&]() { AircraftLayout::load("parse_bench_flight.asc"); });
+    run((std::string("layout img ") + name).c_str(), t.size(),
+	[&]() { AircraftLayout::load("parse_bench_flight.img"); });
+  }
+  std::remove("parse_bench_flight.asc");
+  std::remove("parse_bench_flight.img");
+  return 0;
+}